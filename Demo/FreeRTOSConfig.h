@@ -103,7 +103,20 @@
  * FreeRTOS/Source/tasks.c for limitations. */
 #define configUSE_STATS_FORMATTING_FUNCTIONS      0
 
-#define configKERNEL_INTERRUPT_PRIORITY           ( 255 )        /* All eight bits as QEMU doesn't model the priority bits. */
+/* The S32K3 NVIC implements 4 priority bits (16 levels, 0 is the highest). */
+#define configPRIO_BITS                           4
+
+/* The lowest interrupt priority, as used by NVIC_SetPriority(). */
+#define configLIBRARY_LOWEST_INTERRUPT_PRIORITY          15
+
+/* The highest interrupt priority from which interrupt safe FreeRTOS API
+ * functions can be called, as used by NVIC_SetPriority(). Interrupts with a
+ * higher priority (a lower value) are never masked by the kernel. */
+#define configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY     5
+
+/* The values written in the priority registers and in BASEPRI, shifted in the
+ * implemented upper bits. */
+#define configKERNEL_INTERRUPT_PRIORITY           ( configLIBRARY_LOWEST_INTERRUPT_PRIORITY << ( 8 - configPRIO_BITS ) )
 
 #ifndef __IASMARM__ /* Prevent C code being included in IAR asm files. */
 	#define configASSERT( x ) if( ( x ) == 0 ) while(1);
@@ -112,7 +125,7 @@
 
 /* !!!! configMAX_SYSCALL_INTERRUPT_PRIORITY must not be set to zero !!!!
  * See http://www.FreeRTOS.org/RTOS-Cortex-M3-M4.html. */
-#define configMAX_SYSCALL_INTERRUPT_PRIORITY             ( 4 )
+#define configMAX_SYSCALL_INTERRUPT_PRIORITY             ( configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY << ( 8 - configPRIO_BITS ) )
 
 /* Use the Cortex-M3 optimised task selection rather than the generic C code
  * version. */
@@ -8,10 +8,8 @@
 
 /* Scheduler includes. */
 #include "FreeRTOS.h"
-#include <stdio.h>
-#include <stdlib.h>
 #include "semphr.h"
-#include "uart.h"
+#include "log.h"
 
 /* Demo includes. */
 #include "IntTimer.h"
@@ -21,197 +19,138 @@
 #define tmrTIMER_00_FREQUENCY	( 1UL )
 #define tmrTIMER_01_FREQUENCY	( 10UL )
 #define tmrTIMER_10_FREQUENCY	( 7UL )
-// IRQ lines
+// IRQ lines, one per module
 #define TIMER0_IRQn 			(96)
-#define TIMER1_IRQn 			(97)
 
-typedef struct
-{
-	__IO uint32_t RELOAD;						// Offset: 0x1x0 (R/W) Timer load value (specifies the length of the timeout period in clock cycles)
-	__O  uint32_t  VALUE;                     	// Offset: 0x1x4 (R) Current timer value (indicates the current timer value)
-	__IO uint32_t  CTRL;                 	    // Offset: 0x1x8 (R/W) Timer control (controls timer behaviour)
-	union {
-		__I    uint32_t  INTSTATUS;             // Offset: 0x1xC (R/ ) Interrupt Status Register
-		__O    uint32_t  INTCLEAR;              // Offset: 0x1xC ( /W) Interrupt Clear Register
-	};
-} S32K358_CHANNEL_TypeDef;
-// Data structure modelling the timer's registers
-typedef struct
-{
-	__IO uint32_t PIT_CTRL; 					// Offset: 0x000 (R/W) PIT module control: enables the PIT timer clock
-	char UNIMPLEMENTED[0x100 - 0x4];			// We do not model the registers between 0x004 to 0x100
-	S32K358_CHANNEL_TypeDef channels[4];
-} S32K358_TIMER_TypeDef;
-
-// Timers' memory mapping
-#define TIMER_0_BASE_ADDRESS (0x400B0000UL)
-#define S32K358_TIMER0       ((S32K358_TIMER_TypeDef  *) TIMER_0_BASE_ADDRESS  )
-#define TIMER_1_BASE_ADDRESS (0x400B4000UL)
-#define S32K358_TIMER1       ((S32K358_TIMER_TypeDef  *) TIMER_1_BASE_ADDRESS  )
-#define TIMER_2_BASE_ADDRESS (0x402FC000UL)
-#define S32K358_TIMER2       ((S32K358_TIMER_TypeDef  *) TIMER_2_BASE_ADDRESS  )
-
-S32K358_TIMER_TypeDef* tGetTimer(uint32_t timer) {
-	switch (timer) {
-		case 0:
-			return S32K358_TIMER0;
-		case 1:
-			return S32K358_TIMER1;
-		case 2:
-			return S32K358_TIMER2;
-		default:
-			return NULL;
-	}
-}
+// Callbacks of the channels, and channels with a callback for each module
+static struct {
+	PitCallback_t xCallback;
+	void *pvArg;
+} pit_callbacks[PIT_TIMERS][PIT_CHANNELS];
+static volatile uint8_t pit_active[PIT_TIMERS];
 
-S32K358_CHANNEL_TypeDef* cGetChannel(S32K358_TIMER_TypeDef *timer, uint32_t channel) {
-	switch (channel) {
-		case 0 ... 3:
-			return &(timer->channels[channel]);
-		default:
-			return NULL;
+/*
+ * The four channels of a module share the same irq: each flag of the active
+ * channels is read once, cleared if set, and the callback of the channel is
+ * called. The yield, if needed, is requested once at the end.
+ */
+static void vPitDispatch( uint32_t n_timer ) {
+	BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+	S32K358_TIMER_TypeDef *timer = tGetTimer(n_timer);
+	uint32_t active = pit_active[n_timer];
+	uint32_t n_channel;
+
+	for (n_channel = 0; active; n_channel++, active >>= 1) {
+		if ((active & 1) && timer->channels[n_channel].INTSTATUS) {
+			timer->channels[n_channel].INTCLEAR = ( 1ul << 0 );
+			pit_callbacks[n_timer][n_channel].xCallback(n_timer, n_channel,
+				pit_callbacks[n_timer][n_channel].pvArg, &xHigherPriorityTaskWoken);
+		}
 	}
+	portYIELD_FROM_ISR( xHigherPriorityTaskWoken );
 }
 
-extern SemaphoreHandle_t xBinarySemaphoreA;
-extern SemaphoreHandle_t xBinarySemaphoreB;
-extern SemaphoreHandle_t xBinarySemaphoreC;
-
 void vTimer0Handler() {
-	BaseType_t xHigherPriorityTaskWoken0 = pdFALSE, xHigherPriorityTaskWoken1 = pdFALSE;
-	S32K358_CHANNEL_TypeDef * channel0 = cGetChannel(S32K358_TIMER0, CHANNEL0);
-	S32K358_CHANNEL_TypeDef * channel1 = cGetChannel(S32K358_TIMER0, CHANNEL1);
-
-	// The timer's four channels share the same irq, so we have to check which one triggered the interrupt
-	if (channel0->INTSTATUS) {
-		channel0->INTCLEAR = ( 1ul << 0 );
-		xSemaphoreGiveFromISR(xBinarySemaphoreA, &xHigherPriorityTaskWoken0);
-		portYIELD_FROM_ISR( xHigherPriorityTaskWoken0 );
-	}
-
-	if (channel1->INTSTATUS) {
-		channel1->INTCLEAR = ( 1ul << 0 );
-		xSemaphoreGiveFromISR(xBinarySemaphoreB, &xHigherPriorityTaskWoken1);
-		portYIELD_FROM_ISR( xHigherPriorityTaskWoken1 );
-	}
+	vPitDispatch(TIMER0);
 }
 
 void vTimer1Handler() {
-	BaseType_t xHigherPriorityTaskWoken = pdFALSE;
-	S32K358_CHANNEL_TypeDef * channel = cGetChannel(S32K358_TIMER1, CHANNEL0);
-	channel->INTCLEAR = ( 1ul << 0 );
+	vPitDispatch(TIMER1);
+}
 
-	xSemaphoreGiveFromISR(xBinarySemaphoreC, &xHigherPriorityTaskWoken);
-	portYIELD_FROM_ISR( xHigherPriorityTaskWoken );
+void vTimer2Handler() {
+	vPitDispatch(TIMER2);
 }
 
-void vInitialiseChannel(S32K358_CHANNEL_TypeDef *channel, uint32_t frequency) {
+BaseType_t xPitStartChannel( uint32_t n_timer, uint32_t n_channel, uint32_t reload,
+							 PitCallback_t xCallback, void *pvArg ) {
+	S32K358_TIMER_TypeDef *timer;
+	S32K358_CHANNEL_TypeDef *channel;
+
+	if (n_timer >= PIT_TIMERS || n_channel >= PIT_CHANNELS || xCallback == NULL)
+		return pdFALSE;
+	timer = tGetTimer(n_timer);
+	channel = &timer->channels[n_channel];
+
+	timer->PIT_CTRL &= ~2; // the second bit is the one that enables/disables the module (0 = enabled)
+	channel->CTRL = 0;
 	channel->INTCLEAR = ( 1ul << 0 );
-	channel->RELOAD   = ( configCPU_CLOCK_HZ * frequency);
+	pit_callbacks[n_timer][n_channel].xCallback = xCallback;
+	pit_callbacks[n_timer][n_channel].pvArg = pvArg;
+	pit_active[n_timer] |= 1 << n_channel;
+	channel->RELOAD   = reload;
 	channel->CTRL     = ( ( 1ul <<  1 ) | /* Enable Timer interrupt. */
-						     ( 1ul <<  0 ) );  /* Enable Timer. */
+						  ( 1ul <<  0 ) );  /* Enable Timer. */
+
+	// Set the interrupt priority and enable the irq
+	NVIC_SetPriority( TIMER0_IRQn + n_timer, configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY + 1);
+	NVIC_EnableIRQ( TIMER0_IRQn + n_timer );
+	return pdTRUE;
 }
 
-void vInitialiseTimers( void )
-{
-	S32K358_TIMER0->PIT_CTRL &= ~2; // the second bit is the one that enables/disables the module (0 = enabled)
-	vInitialiseChannel(cGetChannel(S32K358_TIMER0, CHANNEL0), tmrTIMER_00_FREQUENCY);
-	vInitialiseChannel(cGetChannel(S32K358_TIMER0, CHANNEL1), tmrTIMER_01_FREQUENCY);
+void vPitStopChannel( uint32_t n_timer, uint32_t n_channel ) {
+	if (n_timer >= PIT_TIMERS || n_channel >= PIT_CHANNELS)
+		return;
+	cGetChannel(n_timer, n_channel)->CTRL = 0;
+	pit_active[n_timer] &= ~(1 << n_channel);
+}
 
-	S32K358_TIMER1->PIT_CTRL &= ~2;
-	vInitialiseChannel(cGetChannel(S32K358_TIMER1, CHANNEL0), tmrTIMER_10_FREQUENCY);
+extern SemaphoreHandle_t xBinarySemaphoreA;
+extern SemaphoreHandle_t xBinarySemaphoreB;
+extern SemaphoreHandle_t xBinarySemaphoreC;
 
-	// Set the interrupt priority and enable the irq
-	NVIC_SetPriority( TIMER0_IRQn, configMAX_SYSCALL_INTERRUPT_PRIORITY + 1);
-	NVIC_SetPriority( TIMER1_IRQn, configMAX_SYSCALL_INTERRUPT_PRIORITY + 1);
+// Wake up the task waiting on the semaphore passed as argument
+static void vPitGiveSemaphore( uint32_t n_timer, uint32_t n_channel, void *pvArg,
+							   BaseType_t *pxHigherPriorityTaskWoken ) {
+	(void) n_timer;
+	(void) n_channel;
+	xSemaphoreGiveFromISR((SemaphoreHandle_t) pvArg, pxHigherPriorityTaskWoken);
+}
 
-	NVIC_EnableIRQ( TIMER0_IRQn );
-	NVIC_EnableIRQ( TIMER1_IRQn );
+void vInitialiseTimers( void )
+{
+	// Timer 0 channel 0 wakes up TaskA, channel 1 TaskB; timer 1 channel 0 wakes up TaskC
+	xPitStartChannel(TIMER0, CHANNEL0, configCPU_CLOCK_HZ * tmrTIMER_00_FREQUENCY, vPitGiveSemaphore, xBinarySemaphoreA);
+	xPitStartChannel(TIMER0, CHANNEL1, configCPU_CLOCK_HZ * tmrTIMER_01_FREQUENCY, vPitGiveSemaphore, xBinarySemaphoreB);
+	xPitStartChannel(TIMER1, CHANNEL0, configCPU_CLOCK_HZ * tmrTIMER_10_FREQUENCY, vPitGiveSemaphore, xBinarySemaphoreC);
 }
 
-uint32_t ulTimerOK( S32K358_TIMER_TypeDef * timer, S32K358_CHANNEL_TypeDef * channel ) {
-	if (timer->PIT_CTRL & 2) {
-		UART_print("Timer not enabled\n");
+static uint32_t ulTimerOK( uint32_t n_timer, uint32_t n_channel ) {
+	if (n_timer >= PIT_TIMERS) {
+		LOG("Timer %lu does not exists; the board only supports three timers (0-2)\n", n_timer);
+		return 0;
+	}
+	if (n_channel >= PIT_CHANNELS) {
+		LOG("Channel %lu does not exists; the board only supports four channels (0-3)\n", n_channel);
+		return 0;
+	}
+	if (tGetTimer(n_timer)->PIT_CTRL & 2) {
+		LOG("Timer not enabled\n");
 		return 0;
 	}
 	// Check if the channel is enabled
-	if (!(channel->CTRL & 1 )) {
-		UART_print("Channel not enabled\n");
+	if (!(cGetChannel(n_timer, n_channel)->CTRL & 1 )) {
+		LOG("Channel not enabled\n");
 		return 0;
 	}
 	return 1;
 }
 
 BaseType_t xSetReload( uint32_t n_timer, uint32_t n_channel, uint32_t value ) {
-	char msg[100];
-
-	S32K358_TIMER_TypeDef * timer = tGetTimer(n_timer);
-	if (timer == NULL) {
-		snprintf(msg, 100, "Timer %ld does not exists; the board only supports three timers (0-2)\n", n_timer);
-		UART_print(msg);
-		return pdFALSE;
-	}
-
-	S32K358_CHANNEL_TypeDef * channel = cGetChannel(timer, n_channel);
-	if (channel == NULL) {
-		snprintf(msg, 100, "Channel %ld does not exists; the board only supports four channels (0-3)\n", n_channel);
-		UART_print(msg);
+	if (!ulTimerOK(n_timer, n_channel))
 		return pdFALSE;
-	}
-
-	if (!ulTimerOK(timer, channel)) {
-		return pdFALSE;
-	}
-
-	channel->RELOAD = value;
+	vPitSetReload(n_timer, n_channel, value);
 	return pdTRUE;
 }
 
 uint32_t ulGetReload( uint32_t n_timer, uint32_t n_channel ) {
-	char msg[100];
-
-	S32K358_TIMER_TypeDef * timer = tGetTimer(n_timer);
-	if (timer == NULL) {
-		snprintf(msg, 100, "Timer %ld does not exists; the board only supports three timers (0-2)\n", n_timer);
-		UART_print(msg);
+	if (!ulTimerOK(n_timer, n_channel))
 		return 0;
-	}
-
-	S32K358_CHANNEL_TypeDef * channel = cGetChannel(timer, n_channel);
-	if (channel == NULL) {
-		snprintf(msg, 100, "Channel %ld does not exists; the board only supports four channels (0-3)\n", n_channel);
-		UART_print(msg);
-		return 0;
-	}
-
-	if (!ulTimerOK(timer, channel)) {
-		return 0;
-	}
-
-	return channel->RELOAD;
+	return ulPitGetReload(n_timer, n_channel);
 }
 
 uint32_t ulGetCount( uint32_t n_timer, uint32_t n_channel ) {
-	char msg[100];
-
-	S32K358_TIMER_TypeDef * timer = tGetTimer(n_timer);
-	if (timer == NULL) {
-		snprintf(msg, 100, "Timer %ld does not exists; the board only supports three timers (0-2)\n", n_timer);
-		UART_print(msg);
-		return 0;
-	}
-
-	S32K358_CHANNEL_TypeDef * channel = cGetChannel(timer, n_channel);
-	if (channel == NULL) {
-		snprintf(msg, 100, "Channel %ld does not exists; the board only supports four channels (0-3)\n", n_channel);
-		UART_print(msg);
-		return 0;
-	}
-
-	if (!ulTimerOK(timer, channel)) {
+	if (!ulTimerOK(n_timer, n_channel))
 		return 0;
-	}
-
-	return channel->VALUE;
+	return ulPitGetCount(n_timer, n_channel);
 }
-
@@ -9,6 +9,9 @@
 #ifndef INT_TIMER_H
 #define INT_TIMER_H
 
+#include "FreeRTOS.h"
+#include "nvic.h"
+
 enum Timer {
   TIMER0,
   TIMER1,
@@ -22,10 +25,81 @@ enum Channel {
   CHANNEL3
 };
 
+#define PIT_TIMERS		3
+#define PIT_CHANNELS	4
+
+typedef struct
+{
+	__IO uint32_t RELOAD;						// Offset: 0x1x0 (R/W) Timer load value (specifies the length of the timeout period in clock cycles)
+	__O  uint32_t  VALUE;                     	// Offset: 0x1x4 (R) Current timer value (indicates the current timer value)
+	__IO uint32_t  CTRL;                 	    // Offset: 0x1x8 (R/W) Timer control (controls timer behaviour)
+	union {
+		__I    uint32_t  INTSTATUS;             // Offset: 0x1xC (R/ ) Interrupt Status Register
+		__O    uint32_t  INTCLEAR;              // Offset: 0x1xC ( /W) Interrupt Clear Register
+	};
+} S32K358_CHANNEL_TypeDef;
+// Data structure modelling the timer's registers
+typedef struct
+{
+	__IO uint32_t PIT_CTRL; 					// Offset: 0x000 (R/W) PIT module control: enables the PIT timer clock
+	char UNIMPLEMENTED[0x100 - 0x4];			// We do not model the registers between 0x004 to 0x100
+	S32K358_CHANNEL_TypeDef channels[4];
+} S32K358_TIMER_TypeDef;
+
+// Timers' memory mapping
+#define TIMER_0_BASE_ADDRESS (0x400B0000UL)
+#define S32K358_TIMER0       ((S32K358_TIMER_TypeDef  *) TIMER_0_BASE_ADDRESS  )
+#define TIMER_1_BASE_ADDRESS (0x400B4000UL)
+#define S32K358_TIMER1       ((S32K358_TIMER_TypeDef  *) TIMER_1_BASE_ADDRESS  )
+#define TIMER_2_BASE_ADDRESS (0x402FC000UL)
+#define S32K358_TIMER2       ((S32K358_TIMER_TypeDef  *) TIMER_2_BASE_ADDRESS  )
+
+/*
+ * Unchecked accessors, forced inline: with constant timer and channel (e.g.
+ * ulPitGetCount(TIMER0, CHANNEL1) for a timestamp) the address is known at
+ * build time and each one compiles to a single load or store.
+ */
+#define PIT_INLINE	static inline __attribute__((always_inline))
+
+PIT_INLINE S32K358_TIMER_TypeDef *tGetTimer( uint32_t n_timer ) {
+	return n_timer == TIMER2 ? S32K358_TIMER2 :
+		   (S32K358_TIMER_TypeDef *) (TIMER_0_BASE_ADDRESS + n_timer * (TIMER_1_BASE_ADDRESS - TIMER_0_BASE_ADDRESS));
+}
+
+PIT_INLINE S32K358_CHANNEL_TypeDef *cGetChannel( uint32_t n_timer, uint32_t n_channel ) {
+	return &tGetTimer(n_timer)->channels[n_channel];
+}
+
+PIT_INLINE uint32_t ulPitGetCount( uint32_t n_timer, uint32_t n_channel ) {
+	return cGetChannel(n_timer, n_channel)->VALUE;
+}
+
+PIT_INLINE uint32_t ulPitGetReload( uint32_t n_timer, uint32_t n_channel ) {
+	return cGetChannel(n_timer, n_channel)->RELOAD;
+}
+
+PIT_INLINE void vPitSetReload( uint32_t n_timer, uint32_t n_channel, uint32_t value ) {
+	cGetChannel(n_timer, n_channel)->RELOAD = value;
+}
+
+/*
+ * Called from the interrupt handler of the module when the channel expires
+ * (its flag is already cleared); a task woken by the callback is signalled
+ * through pxHigherPriorityTaskWoken, as for the FromISR functions.
+ */
+typedef void (*PitCallback_t)( uint32_t n_timer, uint32_t n_channel, void *pvArg,
+							   BaseType_t *pxHigherPriorityTaskWoken );
+
+// Start a channel with the given reload value, calling xCallback at every expiry
+BaseType_t xPitStartChannel( uint32_t n_timer, uint32_t n_channel, uint32_t reload,
+							 PitCallback_t xCallback, void *pvArg );
+void vPitStopChannel( uint32_t n_timer, uint32_t n_channel );
+
 void vInitialiseTimers( void );
+
+// Checked accessors, for timer and channel known only at run time
 uint32_t ulGetReload( uint32_t n_timer, uint32_t n_channel );
 BaseType_t xSetReload( uint32_t n_timer, uint32_t n_channel, uint32_t value );
 uint32_t ulGetCount( uint32_t n_timer, uint32_t n_channel );
 
 #endif
-
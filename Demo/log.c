@@ -0,0 +1,34 @@
+/*
+ * FreeRTOS application s32k358 tokenized logging.
+ *
+ * SPDX-License-Identifier: CC-BY-NC-4.0
+ * Copyright (c) 2025 Braidotti Sara, Iorio Chiara, Pani Matteo.
+ *
+ */
+
+#include "log.h"
+#include "uart.h"
+
+#if LOG_TOKENIZED
+
+void vLogWrite( const char *fmt, const uint32_t *args, uint32_t n_args ) {
+	uint8_t record[4 + 4 * LOG_MAX_ARGS];
+	// The section starts at address 0, so the address of the string is its offset
+	uint32_t id = (uint32_t) fmt;
+	uint32_t i;
+
+	record[0] = LOG_RECORD_START;
+	record[1] = n_args;
+	record[2] = id & 0xFF;
+	record[3] = (id >> 8) & 0xFF;
+	for (i = 0; i < n_args; i++) {
+		record[4 + 4 * i] = args[i] & 0xFF;
+		record[5 + 4 * i] = (args[i] >> 8) & 0xFF;
+		record[6 + 4 * i] = (args[i] >> 16) & 0xFF;
+		record[7 + 4 * i] = (args[i] >> 24) & 0xFF;
+	}
+	// The record goes in the transmit ring buffer of the LPUART, or is dropped if it is full
+	UART_write(record, 4 + 4 * n_args);
+}
+
+#endif
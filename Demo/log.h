@@ -0,0 +1,62 @@
+/*
+ * FreeRTOS application s32k358 tokenized logging.
+ *
+ * SPDX-License-Identifier: CC-BY-NC-4.0
+ * Copyright (c) 2025 Braidotti Sara, Iorio Chiara, Pani Matteo.
+ *
+ */
+
+#ifndef __LOG__
+#define __LOG__
+
+#include <stdint.h>
+#include "FreeRTOS.h"
+
+/*
+ * With LOG_TOKENIZED the format strings are placed in the .logstr section,
+ * which is kept in the ELF but not loaded in the board, and a log line only
+ * sends the offset of its format string in the section and the raw arguments.
+ * logdecode.py rebuilds the text from the ELF. Without it, the line is
+ * formatted on the board with snprintf.
+ *
+ * The arguments must be integers (char, int, long, enum...) of at most 32 bits:
+ * strings, pointers and floating point values cannot be deferred.
+ */
+#ifndef LOG_TOKENIZED
+#define LOG_TOKENIZED 1
+#endif
+
+#define LOG_MAX_ARGS 8
+// First byte of a record, a control character that does not appear in the text
+#define LOG_RECORD_START 0x1E
+
+#if LOG_TOKENIZED
+
+/* Record: LOG_RECORD_START, number of arguments, offset of the format string
+ * (16 bits) and the arguments (32 bits each), all little endian
+ */
+void vLogWrite( const char *fmt, const uint32_t *args, uint32_t n_args );
+
+#define LOG(fmt, ...) do { \
+	static const char _log_fmt[] __attribute__((section(".logstr"))) = fmt; \
+	const uint32_t _log_args[] = { 0, ##__VA_ARGS__ }; \
+	_Static_assert(sizeof(_log_args) / sizeof(uint32_t) - 1 <= LOG_MAX_ARGS, "too many log arguments"); \
+	vLogWrite(_log_fmt, &_log_args[1], sizeof(_log_args) / sizeof(uint32_t) - 1); \
+} while (0)
+
+#else
+
+#include <stdio.h>
+#include "uart.h"
+
+#define LOG_LINE_LEN 150
+
+#define LOG(fmt, ...) do { \
+	char _log_line[LOG_LINE_LEN]; \
+	snprintf(_log_line, LOG_LINE_LEN, fmt, ##__VA_ARGS__); \
+	UART_print(_log_line); \
+} while (0)
+
+#endif
+
+#endif
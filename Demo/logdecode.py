@@ -0,0 +1,102 @@
+#!/usr/bin/env python3
+#
+# Decoder of the s32k358 tokenized log.
+#
+# SPDX-License-Identifier: CC-BY-NC-4.0
+# Copyright (c) 2025 Braidotti Sara, Iorio Chiara, Pani Matteo.
+#
+# Reads the output of the LPUART from the standard input (or from a file) and
+# writes it to the standard output, replacing the log records with their text.
+# The format strings are read from the .logstr section of the firmware ELF.
+#
+#   usage: logdecode.py firmware.elf [uart.bin]
+
+import re
+import struct
+import sys
+
+LOG_RECORD_START = 0x1E
+
+# printf conversion with the flags, width, precision and length supported by log.h
+CONVERSION = re.compile(r'%([-+ #0]*)(\d*)(?:\.(\d+))?(hh|h|l|z|j|t)?([diuoxXc%])')
+
+
+def read_logstr(path):
+    """Return the .logstr section of a 32 bits little endian ELF and its address"""
+    with open(path, 'rb') as f:
+        elf = f.read()
+    if elf[:4] != b'\x7fELF' or elf[4] != 1 or elf[5] != 1:
+        sys.exit(f'logdecode: {path} is not a 32 bits little endian ELF')
+    shoff, = struct.unpack_from('<I', elf, 0x20)
+    shentsize, shnum, shstrndx = struct.unpack_from('<HHH', elf, 0x2E)
+
+    def section(i):
+        # name, type, flags, addr, offset, size
+        return struct.unpack_from('<IIIIII', elf, shoff + i * shentsize)
+
+    strtab = section(shstrndx)
+    for i in range(shnum):
+        name, _, _, addr, offset, size = section(i)
+        start = strtab[4] + name
+        if elf[start:elf.index(b'\0', start)] == b'.logstr':
+            return elf[offset:offset + size], addr
+    sys.exit(f'logdecode: {path} has no .logstr section (built without LOG_TOKENIZED?)')
+
+
+def format_record(fmt, args):
+    """Format the arguments as printf does for 32 bits integers"""
+    args = iter(args)
+
+    def convert(m):
+        flags, width, prec, _, conv = m.groups()
+        if conv == '%':
+            return '%'
+        value = next(args, 0)
+        if conv == 'c':
+            return ('%' + flags + width + 'c') % chr(value & 0xFF)
+        if conv in 'di':
+            value = value - (1 << 32) if value & 0x80000000 else value
+        spec = '%' + flags + width + ('.' + prec if prec else '') + ('d' if conv == 'u' else conv)
+        return spec % value
+
+    return CONVERSION.sub(convert, fmt)
+
+
+def main():
+    if len(sys.argv) not in (2, 3):
+        sys.exit('usage: logdecode.py firmware.elf [uart.bin]')
+    logstr, base = read_logstr(sys.argv[1])
+    src = open(sys.argv[2], 'rb') if len(sys.argv) == 3 else sys.stdin.buffer
+    out = sys.stdout.buffer
+
+    def read(n):
+        data = src.read(n)
+        if len(data) < n:
+            raise EOFError
+        return data
+
+    try:
+        while True:
+            # The plain text (UART_print) is copied as it is
+            byte = src.read(1)
+            if not byte:
+                break
+            if byte[0] != LOG_RECORD_START:
+                out.write(byte)
+                out.flush()
+                continue
+            n_args, offset = struct.unpack('<BH', read(3))
+            args = struct.unpack(f'<{n_args}I', read(4 * n_args))
+            start = offset - base
+            if not 0 <= start < len(logstr):
+                out.write(f'<bad log record: offset 0x{offset:04x}>\n'.encode())
+                continue
+            fmt = logstr[start:logstr.index(b'\0', start)].decode(errors='replace')
+            out.write(format_record(fmt, args).encode())
+            out.flush()
+    except (EOFError, KeyboardInterrupt):
+        pass
+
+
+if __name__ == '__main__':
+    main()
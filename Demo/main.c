@@ -12,6 +12,7 @@
 #include "task.h"
 #include "semphr.h"
 #include "IntTimer.h"
+#include "log.h"
 
 #include "uart.h"
 #define mainTASK_PRIORITY    ( tskIDLE_PRIORITY + 2 )
@@ -20,10 +21,9 @@
 SemaphoreHandle_t xBinarySemaphoreA;
 SemaphoreHandle_t xBinarySemaphoreB;
 SemaphoreHandle_t xBinarySemaphoreC;
-SemaphoreHandle_t xBinarySemaphoreD;
 
 uint32_t n_timer10 = 0, n_timer01 = 0;
-char msgA[150], msgB[150], msgC[150], msgD[200], usr_buf[LEN_USR_BUF];
+char msgD[200], usr_buf[LEN_USR_BUF];
 
 void vTaskA(void *pvParameters) {
 	(void) pvParameters;
@@ -33,9 +33,8 @@ void vTaskA(void *pvParameters) {
 		if (xSemaphoreTake(xBinarySemaphoreA, portMAX_DELAY) == pdTRUE) {
 			// The semaphore was successfully taken, meaning the ISR occurred
 			// When timer 0 channel 0 expires, the task prints the current value of the other two timers
-			snprintf (msgA, 150, "Task A (timer 00): timer B (01) value=%10ld, timer C (10) value=%10ld\n",
-					  ulGetCount(TIMER0,CHANNEL1), ulGetCount(TIMER1,CHANNEL0));
-			UART_print(msgA);
+			LOG("Task A (timer 00): timer B (01) value=%10lu, timer C (10) value=%10lu\n",
+				ulPitGetCount(TIMER0,CHANNEL1), ulPitGetCount(TIMER1,CHANNEL0));
 		}
 	}
 }
@@ -48,16 +47,13 @@ void vTaskB(void *pvParameters) {
 	while(1) {
 		if (xSemaphoreTake(xBinarySemaphoreB, portMAX_DELAY) == pdTRUE) {
 			// When the timer 0 channel 1 expires, the task changes the period of timer 1 channel 0
-			period = ulGetReload(TIMER1, CHANNEL0);
-			if (n_timer01 % 2 == 0) {
-				if (xSetReload(TIMER1, CHANNEL0, period / 2) == pdFALSE)
-					UART_print("Failed setting new reload value\n");
-			} else {
-				if (xSetReload(TIMER1, CHANNEL0, period * 2) == pdFALSE)
-					UART_print("Failed setting new reload value\n");
-			}
-			snprintf (msgB, 150, "Task B (timer 01): Period of timer C (10) changed from %ld to %ld\n", period, ulGetReload(TIMER1, CHANNEL0));
-			UART_print(msgB);
+			// The timer and the channel are constants, so the accessors are single register accesses
+			period = ulPitGetReload(TIMER1, CHANNEL0);
+			if (n_timer01 % 2 == 0)
+				vPitSetReload(TIMER1, CHANNEL0, period / 2);
+			else
+				vPitSetReload(TIMER1, CHANNEL0, period * 2);
+			LOG("Task B (timer 01): Period of timer C (10) changed from %lu to %lu\n", period, ulPitGetReload(TIMER1, CHANNEL0));
 			n_timer01++;
 		}
 	}
@@ -71,8 +67,7 @@ void vTaskC(void *pvParameters) {
 		if (xSemaphoreTake(xBinarySemaphoreC, portMAX_DELAY) == pdTRUE) {
 			// The task prints the number of times that the timer 1 channel 0 expired
 			n_timer10++;
-			snprintf (msgC, 150, "Task C (timer 10): timer 10 expired %ld times\n", n_timer10);
-			UART_print(msgC);
+			LOG("Task C (timer 10): timer 10 expired %lu times\n", n_timer10);
 		}
 	}
 }
@@ -82,8 +77,8 @@ void vTaskD(void *pvParameters) {
 	UART_print("Hello world from task D\n");
 
 	while(1) {
-		if (xSemaphoreTake(xBinarySemaphoreD, portMAX_DELAY) == pdTRUE) {
-			UART_getRxBuffer(usr_buf, LEN_USR_BUF);
+		if (UART_readLine(usr_buf, LEN_USR_BUF, portMAX_DELAY) == pdTRUE) {
+			// The text of the user is not known at build time, so it is formatted here
 			snprintf (msgD, 200, "Task D: the user wrote %s\n", usr_buf);
 			UART_print(msgD);
 		}
@@ -96,7 +91,6 @@ int main(int argc, char **argv){
 	(void) argv;
 
     UART_init();
-	vInitialiseTimers();
 
 	xTaskCreate(vTaskA, "TaskA", configMINIMAL_STACK_SIZE*5, NULL, mainTASK_PRIORITY, NULL);
 	xTaskCreate(vTaskB, "TaskB", configMINIMAL_STACK_SIZE*5, NULL, mainTASK_PRIORITY, NULL);
@@ -106,11 +100,12 @@ int main(int argc, char **argv){
 	xBinarySemaphoreA = xSemaphoreCreateBinary();
 	xBinarySemaphoreB = xSemaphoreCreateBinary();
 	xBinarySemaphoreC = xSemaphoreCreateBinary();
-	xBinarySemaphoreD = xSemaphoreCreateBinary();
-    if (xBinarySemaphoreA == NULL || xBinarySemaphoreB == NULL || xBinarySemaphoreC == NULL || xBinarySemaphoreD == NULL) {
+    if (xBinarySemaphoreA == NULL || xBinarySemaphoreB == NULL || xBinarySemaphoreC == NULL) {
 		UART_print("Something went wrong in the semaphores creation\n");
 		return -1;
 	}
+	// The timer callbacks give the semaphores, so they are started afterwards
+	vInitialiseTimers();
 
 	// Give control to the scheduler
 	vTaskStartScheduler();
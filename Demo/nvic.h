@@ -19,7 +19,7 @@
 #define     __IOM    volatile            /*! Defines 'read / write' structure member permissions */
 
 #define __STATIC_INLINE  static inline
-#define __NVIC_PRIO_BITS          3U
+#define __NVIC_PRIO_BITS          4U
 
 /**
   \ingroup  CMSIS_core_register
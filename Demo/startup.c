@@ -33,7 +33,8 @@ extern void xPortPendSVHandler( void );
 extern void xPortSysTickHandler( void );
 extern void vTimer0Handler( void );
 extern void vTimer1Handler( void );
-extern void vUart0Handler( void );
+extern void vTimer2Handler( void );
+extern void vUartHandler( void );
 
 /* Exception handlers. */
 static void HardFault_Handler( void ) __attribute__( ( naked ) );
@@ -160,7 +161,7 @@ const uint32_t* isr_vector[] __attribute__((section(".isr_vector"), used)) =
     0,
     ( uint32_t * ) &vTimer0Handler, // TIMER0_Handler // 96
     ( uint32_t * ) &vTimer1Handler, // TIMER1_Handler
-    0,
+    ( uint32_t * ) &vTimer2Handler, // TIMER2_Handler
     0,
     0,
     0,
@@ -203,22 +204,22 @@ const uint32_t* isr_vector[] __attribute__((section(".isr_vector"), used)) =
     0,
     0,
     0,
-    (uint32_t *)&vUart0Handler,
-    0,
-    0,
-    0, // 144
-    0,
-    0,
-    0,
-    0,
-    0,
-    0,
-    0,
-    0,
-    0,
-    0,
-    0,
-    0,
+    (uint32_t *)&vUartHandler, // LPUART0, 141
+    (uint32_t *)&vUartHandler, // LPUART1
+    (uint32_t *)&vUartHandler, // LPUART2
+    (uint32_t *)&vUartHandler, // LPUART3, 144
+    (uint32_t *)&vUartHandler, // LPUART4
+    (uint32_t *)&vUartHandler, // LPUART5
+    (uint32_t *)&vUartHandler, // LPUART6
+    (uint32_t *)&vUartHandler, // LPUART7
+    (uint32_t *)&vUartHandler, // LPUART8
+    (uint32_t *)&vUartHandler, // LPUART9
+    (uint32_t *)&vUartHandler, // LPUART10
+    (uint32_t *)&vUartHandler, // LPUART11
+    (uint32_t *)&vUartHandler, // LPUART12
+    (uint32_t *)&vUartHandler, // LPUART13
+    (uint32_t *)&vUartHandler, // LPUART14
+    (uint32_t *)&vUartHandler, // LPUART15
     0,
     0,
     0,
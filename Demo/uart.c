@@ -6,9 +6,11 @@
  *
  */
 
+#include <string.h>
 #include "uart.h"
 #include "nvic.h"
 #include "semphr.h"
+#include "task.h"
 
 // Data structure modelling the lpuart's registers
 typedef struct
@@ -26,83 +28,421 @@ typedef struct
     __IO uint32_t WATER;
 } S32K358_UART_Typedef;
 
+
 // Lpuart's memory mapping
 #define UART_0_BASE_ADDRESS (0x40328000UL)
 #define S32K358_UART0       ((S32K358_UART_Typedef  *) UART_0_BASE_ADDRESS  )
 
+static S32K358_UART_Typedef * const uart_regs[UART_INSTANCES] = {
+    S32K358_UART0,
+    (S32K358_UART_Typedef *) 0x4032C000UL,
+    (S32K358_UART_Typedef *) 0x40330000UL,
+    (S32K358_UART_Typedef *) 0x40334000UL,
+    (S32K358_UART_Typedef *) 0x40338000UL,
+    (S32K358_UART_Typedef *) 0x4033C000UL,
+    (S32K358_UART_Typedef *) 0x40340000UL,
+    (S32K358_UART_Typedef *) 0x40344000UL,
+    (S32K358_UART_Typedef *) 0x4048C000UL,
+    (S32K358_UART_Typedef *) 0x40490000UL,
+    (S32K358_UART_Typedef *) 0x40494000UL,
+    (S32K358_UART_Typedef *) 0x40498000UL,
+    (S32K358_UART_Typedef *) 0x4049C000UL,
+    (S32K358_UART_Typedef *) 0x404A0000UL,
+    (S32K358_UART_Typedef *) 0x404A4000UL,
+    (S32K358_UART_Typedef *) 0x404A8000UL,
+};
+
 #define TE_SHIFT 19
 #define RE_SHIFT 18
 #define RIE_SHIFT 21
+#define TIE_SHIFT 23
 #define TXFE_SHIFT 7
 #define RXFE_SHIFT 3
 #define TDRE_SHIFT 23
 #define RXEMPT_SHIFT 22
 #define RXFLUSH_SHIFT 14
 #define TXFLUSH_SHIFT 15
+#define TXFIFO_SHIFT 0
+#define TXCOUNT_SHIFT 8
+#define TXCOUNT_MASK (0x1F << TXCOUNT_SHIFT)
+#define RXFIFO_SHIFT 8
+#define RXIDEN_SHIFT 10
+#define RXWATER_SHIFT 16
 
+// The LPUARTs use consecutive IRQ lines
 #define UART0_IRQn 			(141)
-#define BUF_LEN 100
 
-extern SemaphoreHandle_t xBinarySemaphoreD;
-char buf[BUF_LEN];
-uint32_t buf_index = 0;
+/*
+ * State of an LPUART instance.
+ *
+ * Transmit ring buffer: the tasks write at the head and the interrupt handler
+ * drains from the tail into the transmit FIFO. The indexes run freely and are
+ * reduced modulo the (power of two) size, so head - tail is the number of bytes
+ * in the buffer. Each index is written by one side only, so the handler never
+ * needs a lock; the tasks are serialised by a mutex that is held only while
+ * copying, so UARTn_print and UARTn_write never wait for the line. The writers
+ * that wait for room (UARTn_printTimeout) do so without that mutex, one at a
+ * time under a second mutex, so the handler always wakes up the right one.
+ *
+ * Receive ring buffer, the other way round: the interrupt handler drains the
+ * receive FIFO at the head and a single reader task consumes from the tail.
+ * The handler never waits for the reader, so the FIFO never stalls; when the
+ * ring buffer is full the new bytes are dropped and counted.
+ */
+struct UART_Handle {
+    S32K358_UART_Typedef *regs;
+    uint32_t irq;
+    uint32_t tx_fifo_len;
+    // Transmit side
+    char *tx_buf;
+    uint32_t tx_mask; // size of tx_buf - 1
+    volatile uint32_t tx_head;
+    volatile uint32_t tx_tail;
+    SemaphoreHandle_t xTxMutex;
+    // Held by the writer waiting for room
+    SemaphoreHandle_t xTxWaitMutex;
+    // Given by the handler when it frees room and the writer holding xTxWaitMutex is waiting
+    SemaphoreHandle_t xTxSpaceSemaphore;
+    volatile BaseType_t xTxWaiting;
+    // Receive side
+    char *rx_buf;
+    uint32_t rx_mask; // size of rx_buf - 1
+    volatile uint32_t rx_head;
+    volatile uint32_t rx_tail;
+    volatile uint32_t rx_trigger;
+    // An end of line was received since the reader last woke up
+    volatile BaseType_t xRxEol;
+    // Given by the handler when the reader is waiting and its trigger is reached
+    SemaphoreHandle_t xRxSemaphore;
+    volatile BaseType_t xRxWaiting;
+    UART_Stats stats;
+};
 
+static UART_Handle uart_handles[UART_INSTANCES];
+// Instances opened by UART_open, found by the shared interrupt handler
+static UART_Handle * volatile uart_opened[UART_INSTANCES];
+// Instance used by the UART_* functions
+static UART_Handle *uart_console;
+
+UART_Handle *UART_open(uint32_t n, uint32_t tx_len, uint32_t rx_len) {
+    UART_Handle *h;
+    uint32_t rx_fifo_len;
+
+    // The buffer sizes must be powers of two
+    if (n >= UART_INSTANCES || uart_opened[n] != NULL ||
+        tx_len == 0 || (tx_len & (tx_len - 1)) || rx_len == 0 || (rx_len & (rx_len - 1)))
+        return NULL;
+
+    h = &uart_handles[n];
+    memset(h, 0, sizeof(*h));
+    h->regs = uart_regs[n];
+    h->irq = UART0_IRQn + n;
+    h->tx_buf = pvPortMalloc(tx_len);
+    h->rx_buf = pvPortMalloc(rx_len);
+    h->xTxMutex = xSemaphoreCreateMutex();
+    h->xTxWaitMutex = xSemaphoreCreateMutex();
+    h->xTxSpaceSemaphore = xSemaphoreCreateBinary();
+    h->xRxSemaphore = xSemaphoreCreateBinary();
+    configASSERT( h->tx_buf != NULL && h->rx_buf != NULL && h->xTxMutex != NULL &&
+                  h->xTxWaitMutex != NULL && h->xTxSpaceSemaphore != NULL && h->xRxSemaphore != NULL );
+    h->tx_mask = tx_len - 1;
+    h->rx_mask = rx_len - 1;
+    h->rx_trigger = 1;
 
-void UART_init( void )
-{
     /* initialize the UART:
-        * enable the receive and transmit FIFO
-        * set as watermark the FIFO length-1
+        * enable the receive and transmit FIFO (16 bytes on LPUART0 and LPUART1, 4 on the others)
+        * set the watermarks to half the FIFO length
         * enable the transmitter, the receiver and the receiver interrupt
     */
-    uint32_t len_fifo = S32K358_UART0->PARAM & 0x000000FF;
-    S32K358_UART0->FIFO = (1 << TXFE_SHIFT) | (1 << RXFE_SHIFT) | (1 << RXFLUSH_SHIFT) |  (1 << TXFLUSH_SHIFT);
-    S32K358_UART0->WATER = ( (1 << len_fifo) - 1);
-    S32K358_UART0->CTRL = (1 << TE_SHIFT) | (1 << RE_SHIFT) | (1 << RIE_SHIFT);
+    rx_fifo_len = 1 << ((h->regs->PARAM >> RXFIFO_SHIFT) & 0xFF);
+    h->tx_fifo_len = 1 << ((h->regs->PARAM >> TXFIFO_SHIFT) & 0xFF);
 
-    // Set the interrupt priority and enable the irq
-    NVIC_SetPriority( UART0_IRQn, configMAX_SYSCALL_INTERRUPT_PRIORITY + 1);
-	NVIC_EnableIRQ( UART0_IRQn );
+    /* The transmit interrupt (TIE) is enabled only while the ring buffer holds
+     * data: with the transmit watermark at half the FIFO, TDRE is set (and the
+     * handler refills the FIFO in a burst) when half of the FIFO has drained.
+     * The receive interrupt comes when the receive FIFO is half full, leaving
+     * the other half to the bytes arriving before the handler runs, or when
+     * the line has been idle for one character with some bytes in the FIFO
+     * (RXIDEN), so that the last bytes of a burst are not left behind.
+     */
+    h->regs->FIFO = (1 << TXFE_SHIFT) | (1 << RXFE_SHIFT) | (1 << RXFLUSH_SHIFT) |  (1 << TXFLUSH_SHIFT) |
+                    (1 << RXIDEN_SHIFT);
+    h->regs->WATER = ((rx_fifo_len / 2 - 1) << RXWATER_SHIFT) | (h->tx_fifo_len / 2);
+    h->regs->CTRL = (1 << TE_SHIFT) | (1 << RE_SHIFT) | (1 << RIE_SHIFT);
+
+    uart_opened[n] = h;
+    // Set the interrupt priority (below the timers) and enable the irq
+    NVIC_SetPriority( h->irq, configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY + 2);
+    NVIC_EnableIRQ( h->irq );
+    return h;
 }
 
-void UART_print(const char *s) {
-    while(*s != '\0') {
-        // Wait to have enough room in the transmit fifo
-        while(!(S32K358_UART0->STAT & (1 << TDRE_SHIFT)));
+void UART_init( void )
+{
+    uart_console = UART_open(0, UART_TX_BUF_LEN, UART_RX_BUF_LEN);
+}
+
+UART_Handle *UART_getConsole(void) {
+    return uart_console;
+}
+
+void UARTn_getStats(UART_Handle *h, UART_Stats *stats) {
+    *stats = h->stats;
+}
+
+// Copy as much of s as fits in the ring buffer and return the number of bytes copied
+static uint32_t ulTxEnqueue(UART_Handle *h, const char *s, uint32_t len) {
+    uint32_t head = h->tx_head;
+    uint32_t room = h->tx_mask + 1 - (head - h->tx_tail);
+    uint32_t i;
 
-        S32K358_UART0->DATA = (unsigned int)(*s);
-        s++;
+    if (len > room)
+        len = room;
+    for (i = 0; i < len; i++)
+        h->tx_buf[(head + i) & h->tx_mask] = s[i];
+    // The data must be in the buffer before the handler sees the new head
+    __asm volatile ( "dmb" ::: "memory" );
+    h->tx_head = head + len;
+
+    if (len) {
+        // The handler clears TIE when it empties the buffer, so the update must be atomic
+        taskENTER_CRITICAL();
+        h->regs->CTRL |= (1 << TIE_SHIFT);
+        taskEXIT_CRITICAL();
     }
+    return len;
 }
 
-void vUart0Handler() {
-    // When the user writes something, the interrupt is set
-    BaseType_t xHigherPriorityTaskWoken = pdFALSE;
-    // Keep collecting characters till the fifo is full / the user pressed enter
-    while (!(S32K358_UART0->FIFO & (1 << RXEMPT_SHIFT))) {
-        buf[buf_index] = (char) (S32K358_UART0->DATA & 0xFF);
-
-        if (buf[buf_index] == '\r' || buf_index == BUF_LEN-2) {
-            buf[buf_index] = '\0';
-            // Disable the interrupt and activate taskD
-            NVIC_DisableIRQ( UART0_IRQn );
-            xSemaphoreGiveFromISR(xBinarySemaphoreD, &xHigherPriorityTaskWoken);
-            portYIELD_FROM_ISR( xHigherPriorityTaskWoken );
-            return;
+static void vTxLock(UART_Handle *h) {
+    // Before the scheduler starts there is only one writer
+    if (xTaskGetSchedulerState() != taskSCHEDULER_NOT_STARTED)
+        xSemaphoreTake(h->xTxMutex, portMAX_DELAY);
+}
+
+static void vTxUnlock(UART_Handle *h) {
+    if (xTaskGetSchedulerState() != taskSCHEDULER_NOT_STARTED)
+        xSemaphoreGive(h->xTxMutex);
+}
+
+void UARTn_print(UART_Handle *h, const char *s) {
+    uint32_t len = strlen(s);
+
+    vTxLock(h);
+    h->stats.tx_dropped += len - ulTxEnqueue(h, s, len);
+    vTxUnlock(h);
+}
+
+BaseType_t UARTn_write(UART_Handle *h, const void *data, uint32_t len) {
+    BaseType_t xRet = pdFALSE;
+
+    vTxLock(h);
+    // A binary record is useless if truncated, so it is queued entirely or not at all
+    if (h->tx_mask + 1 - (h->tx_head - h->tx_tail) >= len) {
+        ulTxEnqueue(h, data, len);
+        xRet = pdTRUE;
+    } else {
+        h->stats.tx_dropped += len;
+    }
+    vTxUnlock(h);
+    return xRet;
+}
+
+uint32_t UARTn_printTimeout(UART_Handle *h, const char *s, TickType_t xTicksToWait) {
+    uint32_t len = strlen(s);
+    uint32_t queued = 0;
+    uint32_t want;
+    TimeOut_t xTimeOut;
+
+    vTaskSetTimeOutState(&xTimeOut);
+    if (xSemaphoreTake(h->xTxWaitMutex, xTicksToWait) == pdTRUE) {
+        for (;;) {
+            // The string is queued at once, unless it is longer than the whole buffer
+            want = len - queued;
+            if (want > h->tx_mask + 1)
+                want = h->tx_mask + 1;
+            /* Announce the wait before checking the room, so that the handler
+             * cannot free it unnoticed in between
+             */
+            h->xTxWaiting = pdTRUE;
+            vTxLock(h);
+            if (h->tx_mask + 1 - (h->tx_head - h->tx_tail) >= want)
+                queued += ulTxEnqueue(h, s + queued, want);
+            vTxUnlock(h);
+            if (queued == len || xTaskCheckForTimeOut(&xTimeOut, &xTicksToWait) == pdTRUE)
+                break;
+            // A give left over from an earlier wait only causes one more check of the room
+            xSemaphoreTake(h->xTxSpaceSemaphore, xTicksToWait);
         }
+        h->xTxWaiting = pdFALSE;
+        xSemaphoreGive(h->xTxWaitMutex);
+    }
+    vTxLock(h);
+    h->stats.tx_dropped += len - queued;
+    vTxUnlock(h);
+    return queued;
+}
 
-        buf_index++;
+// Refill the transmit FIFO from the ring buffer
+static void vUartTxHandler(UART_Handle *h, BaseType_t *pxHigherPriorityTaskWoken) {
+    uint32_t tail = h->tx_tail;
+    uint32_t count = h->tx_head - tail;
+    uint32_t room = h->tx_fifo_len - ((h->regs->WATER & TXCOUNT_MASK) >> TXCOUNT_SHIFT);
+
+    if (count > room)
+        count = room;
+    for (uint32_t i = 0; i < count; i++)
+        h->regs->DATA = (unsigned int)h->tx_buf[(tail + i) & h->tx_mask];
+    h->tx_tail = tail + count;
+    h->stats.tx_bytes += count;
+
+    // Nothing left to send: stop the interrupt until a writer enqueues more data
+    if (h->tx_tail == h->tx_head)
+        h->regs->CTRL &= ~(1 << TIE_SHIFT);
+
+    if (count && h->xTxWaiting) {
+        h->xTxWaiting = pdFALSE;
+        xSemaphoreGiveFromISR(h->xTxSpaceSemaphore, pxHigherPriorityTaskWoken);
     }
 }
 
-void UART_getRxBuffer(char* usr_buf, uint32_t len) {
-    // Read the data from the receive buffer
-    uint32_t i;
-    buf_index = 0;
-    for(i = 0; i < len-1 && buf[i] != '\0'; i++) {
-        usr_buf[i] = buf[i];
+// Move the received bytes from the FIFO to the ring buffer
+static void vUartRxHandler(UART_Handle *h, BaseType_t *pxHigherPriorityTaskWoken) {
+    uint32_t head = h->rx_head;
+    char c;
+
+    while (!(h->regs->FIFO & (1 << RXEMPT_SHIFT))) {
+        c = (char) (h->regs->DATA & 0xFF);
+        if (head - h->rx_tail == h->rx_mask + 1) {
+            h->stats.rx_overrun++;
+            continue;
+        }
+        h->rx_buf[head & h->rx_mask] = c;
+        head++;
+        if (c == '\r')
+            h->xRxEol = pdTRUE;
+    }
+    h->stats.rx_bytes += head - h->rx_head;
+    // The data must be in the buffer before the reader sees the new head
+    __asm volatile ( "dmb" ::: "memory" );
+    h->rx_head = head;
+
+    if (h->xRxWaiting && (head - h->rx_tail >= h->rx_trigger || h->xRxEol)) {
+        h->xRxWaiting = pdFALSE;
+        xSemaphoreGiveFromISR(h->xRxSemaphore, pxHigherPriorityTaskWoken);
     }
-    usr_buf[i] = '\0';
-    // enable the interrupt again
-    NVIC_EnableIRQ( UART0_IRQn );
+}
+
+// Handler of the interrupts of all the LPUARTs: the instance is given by the active exception
+void vUartHandler() {
+    BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+    uint32_t ipsr;
+    UART_Handle *h;
+
+    // IPSR holds the exception number, that is the IRQ number + 16
+    __asm volatile ( "mrs %0, ipsr" : "=r" (ipsr) );
+    h = uart_opened[(ipsr & 0x1FF) - 16 - UART0_IRQn];
+    h->stats.irqs++;
+
+    if ((h->regs->CTRL & (1 << TIE_SHIFT)) && (h->regs->STAT & (1 << TDRE_SHIFT)))
+        vUartTxHandler(h, &xHigherPriorityTaskWoken);
+    vUartRxHandler(h, &xHigherPriorityTaskWoken);
+    portYIELD_FROM_ISR( xHigherPriorityTaskWoken );
+}
+
+uint32_t UARTn_rxPeek(UART_Handle *h, const char **data) {
+    uint32_t tail = h->rx_tail;
+    uint32_t count = h->rx_head - tail;
+    uint32_t contiguous = h->rx_mask + 1 - (tail & h->rx_mask);
+
+    *data = &h->rx_buf[tail & h->rx_mask];
+    return count < contiguous ? count : contiguous;
+}
+
+void UARTn_rxConsume(UART_Handle *h, uint32_t len) {
+    uint32_t count = h->rx_head - h->rx_tail;
+
+    // The bytes must have been read before the handler can overwrite them
+    __asm volatile ( "dmb" ::: "memory" );
+    h->rx_tail += len < count ? len : count;
+}
+
+void UARTn_setRxTrigger(UART_Handle *h, uint32_t level) {
+    h->rx_trigger = level ? level : 1;
+}
+
+BaseType_t UARTn_rxWait(UART_Handle *h, TickType_t xTicksToWait) {
+    BaseType_t xRet = pdTRUE;
+
+    // Announce the wait before checking the condition, as in UARTn_printTimeout
+    h->xRxWaiting = pdTRUE;
+    if (h->rx_head - h->rx_tail < h->rx_trigger && !h->xRxEol)
+        xRet = xSemaphoreTake(h->xRxSemaphore, xTicksToWait);
+    h->xRxWaiting = pdFALSE;
+    h->xRxEol = pdFALSE;
+    return xRet;
+}
+
+BaseType_t UARTn_readLine(UART_Handle *h, char *usr_buf, uint32_t len, TickType_t xTicksToWait) {
+    TimeOut_t xTimeOut;
+    uint32_t tail, count, i;
+    BaseType_t xEol;
+
+    // There must be room at least for the terminator
+    if (len == 0)
+        return pdFALSE;
+    vTaskSetTimeOutState(&xTimeOut);
+    for (;;) {
+        // Look for the end of the line among the received bytes, without moving them
+        tail = h->rx_tail;
+        count = h->rx_head - tail;
+        for (i = 0; i < count && i < len - 1; i++) {
+            if (h->rx_buf[(tail + i) & h->rx_mask] == '\r')
+                break;
+        }
+        xEol = i < count && i < len - 1;
+        if (xEol || i == len - 1) {
+            for (uint32_t j = 0; j < i; j++)
+                usr_buf[j] = h->rx_buf[(tail + j) & h->rx_mask];
+            usr_buf[i] = '\0';
+            UARTn_rxConsume(h, i + xEol);
+            return pdTRUE;
+        }
+        if (xTaskCheckForTimeOut(&xTimeOut, &xTicksToWait) == pdTRUE)
+            return pdFALSE;
+        UARTn_rxWait(h, xTicksToWait);
+    }
+}
+
+// The UART_* functions work on the console, LPUART0
+
+void UART_print(const char *s) {
+    UARTn_print(uart_console, s);
+}
+
+BaseType_t UART_write(const void *data, uint32_t len) {
+    return UARTn_write(uart_console, data, len);
+}
+
+uint32_t UART_printTimeout(const char *s, TickType_t xTicksToWait) {
+    return UARTn_printTimeout(uart_console, s, xTicksToWait);
+}
+
+uint32_t UART_rxPeek(const char **data) {
+    return UARTn_rxPeek(uart_console, data);
+}
+
+void UART_rxConsume(uint32_t len) {
+    UARTn_rxConsume(uart_console, len);
+}
+
+void UART_setRxTrigger(uint32_t level) {
+    UARTn_setRxTrigger(uart_console, level);
+}
+
+BaseType_t UART_rxWait(TickType_t xTicksToWait) {
+    return UARTn_rxWait(uart_console, xTicksToWait);
+}
+
+BaseType_t UART_readLine(char *usr_buf, uint32_t len, TickType_t xTicksToWait) {
+    return UARTn_readLine(uart_console, usr_buf, len, xTicksToWait);
 }
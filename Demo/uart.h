@@ -11,8 +11,68 @@
 
 #include "FreeRTOS.h"
 
+#define UART_INSTANCES 16
+
+// Size of the transmit and receive ring buffers of the console (powers of two)
+#define UART_TX_BUF_LEN 1024
+#define UART_RX_BUF_LEN 256
+
+typedef struct UART_Handle UART_Handle;
+
+// Counters of an instance, e.g. to measure the throughput and the interrupt load
+typedef struct {
+    uint32_t tx_bytes; // bytes moved to the transmit FIFO
+    uint32_t tx_dropped; // bytes discarded because the transmit ring buffer was full
+    uint32_t rx_bytes; // bytes moved from the receive FIFO to the ring buffer
+    uint32_t rx_overrun; // bytes discarded because the receive ring buffer was full
+    uint32_t irqs; // interrupts handled
+} UART_Stats;
+
+/*
+ * Configure LPUART n (0-15) with transmit and receive ring buffers of the given
+ * sizes (powers of two, allocated from the FreeRTOS heap) and enable its
+ * interrupt. It returns NULL if the instance does not exist or is already open.
+ * All the instances share the interrupt handler vUartHandler.
+ */
+UART_Handle *UART_open(uint32_t n, uint32_t tx_len, uint32_t rx_len);
+void UARTn_getStats(UART_Handle *h, UART_Stats *stats);
+
+// Queue s for transmission and return at once; what does not fit in the buffer is dropped
+void UARTn_print(UART_Handle *h, const char *s);
+// Queue len bytes for transmission if they all fit in the buffer, otherwise drop them and return pdFALSE
+BaseType_t UARTn_write(UART_Handle *h, const void *data, uint32_t len);
+/* Queue s for transmission, waiting up to xTicksToWait for room in the buffer
+ * (only from a task); the other writers are not held up meanwhile. s is queued
+ * at once if it fits in the buffer, so it is not split by other output. Return
+ * the number of bytes queued: on timeout nothing, or only the start of a string
+ * longer than the buffer, is sent.
+ */
+uint32_t UARTn_printTimeout(UART_Handle *h, const char *s, TickType_t xTicksToWait);
+
+/*
+ * Receive side, for a single reader task per instance. The received bytes stay
+ * in the ring buffer until consumed: UARTn_rxPeek points to the oldest ones and
+ * returns how many are contiguous (the rest, if any, are at the start of the buffer).
+ */
+uint32_t UARTn_rxPeek(UART_Handle *h, const char **data);
+void UARTn_rxConsume(UART_Handle *h, uint32_t len);
+// UARTn_rxWait returns when level bytes are available or an end of line arrived
+void UARTn_setRxTrigger(UART_Handle *h, uint32_t level);
+// Wait up to xTicksToWait for the trigger; it may return early, so check what is available
+BaseType_t UARTn_rxWait(UART_Handle *h, TickType_t xTicksToWait);
+// Copy the next line (without its end) in usr_buf, waiting up to xTicksToWait for it
+BaseType_t UARTn_readLine(UART_Handle *h, char *usr_buf, uint32_t len, TickType_t xTicksToWait);
+
+// The console is LPUART0, opened by UART_init and used by the functions below
 void UART_init(void);
+UART_Handle *UART_getConsole(void);
 void UART_print(const char *s);
-void UART_getRxBuffer(char* usr_buf, uint32_t len);
+BaseType_t UART_write(const void *data, uint32_t len);
+uint32_t UART_printTimeout(const char *s, TickType_t xTicksToWait);
+uint32_t UART_rxPeek(const char **data);
+void UART_rxConsume(uint32_t len);
+void UART_setRxTrigger(uint32_t level);
+BaseType_t UART_rxWait(TickType_t xTicksToWait);
+BaseType_t UART_readLine(char *usr_buf, uint32_t len, TickType_t xTicksToWait);
 
 #endif
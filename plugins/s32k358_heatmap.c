@@ -0,0 +1,294 @@
+/*
+ * TCG plugin: memory access heatmap of the s32k358 firmware, to choose what to place in the TCMs
+ *
+ * SPDX-License-Identifier: CC-BY-NC-4.0
+ * Copyright (c) 2025 Braidotti Sara, Iorio Chiara, Pani Matteo.
+ *
+ * The instruction fetches of every function and the data accesses of every
+ * function to every memory region of the MCU are counted, as well as the
+ * accesses to every data object of the firmware ELF. At exit the functions
+ * executed outside the ITCM and the objects accessed outside the DTCM are
+ * ranked as candidates to be moved into the TCMs.
+ *
+ * Arguments:
+ *  elf=<file>      firmware ELF with the symbol table (required)
+ *  out=<file>      report (default: QEMU log, -d plugin)
+ *  top=<n>         entries of each ranked list (default 20)
+ */
+
+#include <inttypes.h>
+#include <glib.h>
+
+#include <qemu-plugin.h>
+
+#include "s32k358_syms.h"
+
+QEMU_PLUGIN_EXPORT int qemu_plugin_version = QEMU_PLUGIN_VERSION;
+
+#define ITCM_SIZE   (64 * 1024)
+#define DTCM_SIZE   (128 * 1024)
+
+struct region {
+    const char *name;
+    uint32_t base;
+    uint32_t size;
+};
+
+// Memory map of the s32k358 machine (see documentation.md)
+enum { ITCM, CFLASH, DFLASH, DTCM, SRAM, PERIPH, PPB, OTHER, NUM_REGIONS };
+static const struct region regions[NUM_REGIONS] = {
+    [ITCM] = { "itcm", 0x00000000, ITCM_SIZE },
+    [CFLASH] = { "cflash", 0x00400000, 0x00800000 },
+    [DFLASH] = { "dflash", 0x10000000, 0x00020000 },
+    [DTCM] = { "dtcm", 0x20000000, DTCM_SIZE },
+    [SRAM] = { "sram", 0x20400000, 0x000C0000 },
+    [PERIPH] = { "periph", 0x40000000, 0x20000000 },
+    [PPB] = { "ppb", 0xE0000000, 0x00100000 },
+    [OTHER] = { "other", 0, 0 },
+};
+
+static struct syms funcs;
+static struct syms objs;
+
+// Instruction fetches of each function, the last entry is for the code outside any function
+static struct qemu_plugin_scoreboard *fetches;
+// Data reads and writes of each function to each region: [func][region][is_store]
+static uint64_t (*data)[NUM_REGIONS][2];
+// Data accesses to each object, and to each region outside any object
+static uint64_t *obj_accesses;
+static uint64_t nosym_accesses[NUM_REGIONS];
+
+static const char *out_path;
+static int top = 20;
+
+static int region_of(uint32_t addr)
+{
+    for (int i = 0; i < OTHER; i++) {
+        if (addr - regions[i].base < regions[i].size)
+            return i;
+    }
+    return OTHER;
+}
+
+static size_t func_index(uint32_t pc)
+{
+    const struct sym *f = syms_find(&funcs, pc);
+
+    return f ? (size_t)(f - funcs.v) : funcs.n;
+}
+
+static void vcpu_mem(unsigned int vcpu_index, qemu_plugin_meminfo_t info,
+                     uint64_t vaddr, void *udata)
+{
+    uint64_t (*row)[2] = udata;
+    int region = region_of(vaddr);
+    const struct sym *o = syms_find(&objs, vaddr);
+
+    __atomic_fetch_add(&row[region][qemu_plugin_mem_is_store(info)], 1, __ATOMIC_RELAXED);
+    if (o)
+        __atomic_fetch_add(&obj_accesses[o - objs.v], 1, __ATOMIC_RELAXED);
+    else
+        __atomic_fetch_add(&nosym_accesses[region], 1, __ATOMIC_RELAXED);
+}
+
+static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
+{
+    size_t n = qemu_plugin_tb_n_insns(tb);
+    size_t f = func_index(qemu_plugin_tb_vaddr(tb));
+    qemu_plugin_u64 entry = { .score = fetches, .offset = f * sizeof(uint64_t) };
+
+    qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu(tb, QEMU_PLUGIN_INLINE_ADD_U64, entry, n);
+    for (size_t i = 0; i < n; i++) {
+        struct qemu_plugin_insn *insn = qemu_plugin_tb_get_insn(tb, i);
+
+        qemu_plugin_register_vcpu_mem_cb(insn, vcpu_mem, QEMU_PLUGIN_CB_NO_REGS,
+                                         QEMU_PLUGIN_MEM_RW, data[f]);
+    }
+}
+
+static uint64_t func_fetches(size_t f)
+{
+    qemu_plugin_u64 entry = { .score = fetches, .offset = f * sizeof(uint64_t) };
+
+    return qemu_plugin_u64_sum(entry);
+}
+
+static uint64_t func_data(size_t f)
+{
+    uint64_t sum = 0;
+
+    for (int r = 0; r < NUM_REGIONS; r++)
+        sum += data[f][r][0] + data[f][r][1];
+    return sum;
+}
+
+static gint count_cmp(gconstpointer a, gconstpointer b, gpointer counts)
+{
+    uint64_t ca = ((uint64_t *)counts)[GPOINTER_TO_UINT(*(gpointer *)a)];
+    uint64_t cb = ((uint64_t *)counts)[GPOINTER_TO_UINT(*(gpointer *)b)];
+
+    return ca < cb ? 1 : ca > cb ? -1 : 0;
+}
+
+// Indexes of the non-zero counts, from the highest
+static GPtrArray *rank(const uint64_t *counts, size_t n, bool (*skip)(size_t))
+{
+    GPtrArray *sorted = g_ptr_array_new();
+
+    for (size_t i = 0; i < n; i++) {
+        if (counts[i] && !(skip && skip(i)))
+            g_ptr_array_add(sorted, GUINT_TO_POINTER(i));
+    }
+    g_ptr_array_sort_with_data(sorted, count_cmp, (gpointer)counts);
+    return sorted;
+}
+
+static bool func_in_itcm(size_t f)
+{
+    return f == funcs.n || region_of(funcs.v[f].addr) == ITCM;
+}
+
+static bool obj_in_dtcm(size_t o)
+{
+    return region_of(objs.v[o].addr) == DTCM;
+}
+
+static void report_candidates(GString *report, const char *title, uint32_t capacity,
+                              const struct syms *s, const uint64_t *counts, bool (*skip)(size_t))
+{
+    g_autoptr(GPtrArray) sorted = rank(counts, s->n, skip);
+    uint64_t total = 0, size = 0;
+
+    for (size_t i = 0; i < s->n; i++)
+        total += skip(i) ? 0 : counts[i];
+
+    g_string_append_printf(report, "\n%s (%u KB), '*' if they fit together with the ones above\n",
+                           title, capacity / 1024);
+    g_string_append_printf(report, "%-4s %-32s %-8s %8s %14s %7s %10s\n",
+                           "rank", "symbol", "region", "size", "accesses", "%", "cumulative");
+    for (guint i = 0; i < sorted->len && i < (guint)top; i++) {
+        const struct sym *sym = &s->v[GPOINTER_TO_UINT(g_ptr_array_index(sorted, i))];
+        uint64_t c = counts[sym - s->v];
+
+        size += sym->size;
+        g_string_append_printf(report, "%-4u %-32s %-8s %8u %14" PRIu64 " %6.2f%% %10" PRIu64 " %s\n",
+                               i + 1, sym->name, regions[region_of(sym->addr)].name, sym->size, c,
+                               100.0 * c / total, size, size <= capacity ? "*" : "");
+    }
+}
+
+static void plugin_exit(qemu_plugin_id_t id, void *p)
+{
+    g_autoptr(GString) report = g_string_new("");
+    g_autofree uint64_t *fetch = g_new0(uint64_t, funcs.n + 1);
+    g_autofree uint64_t *func_accesses = g_new0(uint64_t, funcs.n + 1);
+    g_autoptr(GPtrArray) sorted = NULL;
+    uint64_t region_fetch[NUM_REGIONS] = { 0 };
+    uint64_t region_data[NUM_REGIONS][2] = { { 0 } };
+
+    for (size_t f = 0; f <= funcs.n; f++) {
+        fetch[f] = func_fetches(f);
+        func_accesses[f] = func_data(f);
+        if (f < funcs.n)
+            region_fetch[region_of(funcs.v[f].addr)] += fetch[f];
+        else
+            region_fetch[OTHER] += fetch[f];
+        for (int r = 0; r < NUM_REGIONS; r++) {
+            region_data[r][0] += data[f][r][0];
+            region_data[r][1] += data[f][r][1];
+        }
+    }
+
+    g_string_append_printf(report, "Accesses per memory region\n%-8s %14s %14s %14s %14s\n",
+                           "region", "fetches", "reads", "writes", "no symbol");
+    for (int r = 0; r < NUM_REGIONS; r++) {
+        g_string_append_printf(report, "%-8s %14" PRIu64 " %14" PRIu64 " %14" PRIu64 " %14" PRIu64 "\n",
+                               regions[r].name, region_fetch[r], region_data[r][0],
+                               region_data[r][1], nosym_accesses[r]);
+    }
+
+    report_candidates(report, "ITCM candidates: functions by instruction fetches", ITCM_SIZE,
+                      &funcs, fetch, func_in_itcm);
+    report_candidates(report, "DTCM candidates: data objects by data accesses", DTCM_SIZE,
+                      &objs, obj_accesses, obj_in_dtcm);
+
+    g_string_append_printf(report, "\nFunctions by data accesses, per region\n%-32s", "function");
+    for (int r = 0; r < NUM_REGIONS; r++)
+        g_string_append_printf(report, " %12s", regions[r].name);
+    g_string_append_c(report, '\n');
+    sorted = rank(func_accesses, funcs.n + 1, NULL);
+    for (guint i = 0; i < sorted->len && i < (guint)top; i++) {
+        size_t f = GPOINTER_TO_UINT(g_ptr_array_index(sorted, i));
+
+        g_string_append_printf(report, "%-32s", f < funcs.n ? funcs.v[f].name : "[unknown]");
+        for (int r = 0; r < NUM_REGIONS; r++)
+            g_string_append_printf(report, " %12" PRIu64, data[f][r][0] + data[f][r][1]);
+        g_string_append_c(report, '\n');
+    }
+
+    if (out_path) {
+        if (!g_file_set_contents(out_path, report->str, report->len, NULL))
+            fprintf(stderr, "s32k358_heatmap: cannot write %s\n", out_path);
+    } else {
+        qemu_plugin_outs(report->str);
+    }
+}
+
+// The main stack is not an object of the ELF: it is added from the symbols of the linker script
+static void add_main_stack(const char *elf_path)
+{
+    struct syms labels;
+    const struct sym *limit, *stack_top;
+
+    if (!syms_load(elf_path, STT_NOTYPE, &labels))
+        return;
+    limit = syms_find_by_name(&labels, "__StackLimit");
+    stack_top = syms_find_by_name(&labels, "__StackTop");
+    if (limit && stack_top && stack_top->addr > limit->addr) {
+        objs.v = g_renew(struct sym, objs.v, objs.n + 1);
+        objs.v[objs.n].addr = limit->addr;
+        objs.v[objs.n].size = stack_top->addr - limit->addr;
+        objs.v[objs.n].name = "[main stack]";
+        objs.n++;
+        qsort(objs.v, objs.n, sizeof(*objs.v), sym_cmp);
+    }
+}
+
+QEMU_PLUGIN_EXPORT int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
+                                           int argc, char **argv)
+{
+    const char *elf_path = NULL;
+
+    for (int i = 0; i < argc; i++) {
+        g_auto(GStrv) tokens = g_strsplit(argv[i], "=", 2);
+
+        if (!tokens[1]) {
+            fprintf(stderr, "s32k358_heatmap: option parsing failed: %s\n", argv[i]);
+            return -1;
+        }
+        if (!strcmp(tokens[0], "elf")) {
+            elf_path = g_strdup(tokens[1]);
+        } else if (!strcmp(tokens[0], "out")) {
+            out_path = g_strdup(tokens[1]);
+        } else if (!strcmp(tokens[0], "top")) {
+            top = atoi(tokens[1]);
+        } else {
+            fprintf(stderr, "s32k358_heatmap: option parsing failed: %s\n", argv[i]);
+            return -1;
+        }
+    }
+    if (!elf_path) {
+        fprintf(stderr, "s32k358_heatmap: the firmware ELF is required (elf=<file>)\n");
+        return -1;
+    }
+    if (!syms_load(elf_path, STT_FUNC, &funcs) || !syms_load(elf_path, STT_OBJECT, &objs))
+        return -1;
+    add_main_stack(elf_path);
+
+    fetches = qemu_plugin_scoreboard_new((funcs.n + 1) * sizeof(uint64_t));
+    data = g_malloc0_n(funcs.n + 1, sizeof(*data));
+    obj_accesses = g_new0(uint64_t, objs.n + 1);
+    qemu_plugin_register_vcpu_tb_trans_cb(id, vcpu_tb_trans);
+    qemu_plugin_register_atexit_cb(id, plugin_exit, NULL);
+    return 0;
+}
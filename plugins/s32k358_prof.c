@@ -0,0 +1,452 @@
+/*
+ * TCG plugin: per-function instruction and cycle profiling of the s32k358 firmware
+ *
+ * SPDX-License-Identifier: CC-BY-NC-4.0
+ * Copyright (c) 2025 Braidotti Sara, Iorio Chiara, Pani Matteo.
+ *
+ * The executed instructions and an estimate of the cycles are attributed to
+ * the functions of the firmware ELF, following the calls with a shadow call
+ * stack. The FreeRTOS context switches (entry of xPortPendSVHandler and
+ * vPortSVCHandler) give every task its own call tree, recognised by the
+ * value of PSP when the task is resumed.
+ *
+ * Arguments:
+ *  elf=<file>      firmware ELF with the symbol table (required)
+ *  out=<file>      folded stacks, input of flamegraph.pl (default prof.folded)
+ *  report=<file>   per-task and per-function summary (default: QEMU log, -d plugin)
+ *  weight=cycles|insns  weight of the folded stacks (default cycles)
+ *  top=<n>         functions listed in the summary (default 20)
+ */
+
+#include <inttypes.h>
+#include <glib.h>
+
+#include <qemu-plugin.h>
+
+#include "s32k358_syms.h"
+
+QEMU_PLUGIN_EXPORT int qemu_plugin_version = QEMU_PLUGIN_VERSION;
+
+#define MAX_DEPTH       64
+#define MAX_TASKS       64
+// Distance between PSP at the entry of PendSV and PSP after the task is resumed (exception frame)
+#define MAX_FRAME_SIZE  0x100
+
+// Node of a call tree: a function reached through a given chain of calls
+struct node {
+    const struct sym *func;
+    struct node *child; // first child
+    struct node *next; // next sibling
+    uint64_t insns; // self counts
+    uint64_t cycles;
+};
+
+struct task {
+    uint32_t psp; // PSP when the task was last switched out
+    struct node root;
+    struct node *stack[MAX_DEPTH];
+    int depth;
+};
+
+struct vcpu {
+    struct task tasks[MAX_TASKS];
+    int num_tasks;
+    struct task *cur;
+    bool switching; // between the entry of a switch handler and the return to thread mode
+    struct qemu_plugin_register *psp_reg;
+    struct qemu_plugin_register *xpsr_reg;
+    GByteArray *buf;
+};
+
+// Translation block: function it belongs to, instructions and estimated cycles
+struct tb_info {
+    uint32_t pc;
+    const struct sym *func;
+    bool entry; // the block starts at the first instruction of func
+    bool context_switch; // the block is the entry of a context switch handler
+    unsigned insns;
+    unsigned cycles;
+};
+
+static struct syms funcs;
+static const struct sym unknown_func = { 0, 0, "[unknown]" };
+static const struct sym *switch_funcs[2];
+
+static struct qemu_plugin_scoreboard *vcpus;
+static GHashTable *tbs;
+static GMutex tbs_lock;
+
+static const char *out_path = "prof.folded";
+static const char *report_path;
+static bool weight_insns;
+static int top = 20;
+
+static const struct sym *find_func(uint32_t pc)
+{
+    const struct sym *f = syms_find(&funcs, pc);
+
+    return f ? f : &unknown_func;
+}
+
+/*
+ * Rough Cortex-M7 cost of an instruction from its encoding: the dual issue,
+ * the caches and the wait states are not considered, and every branch is
+ * counted as taken
+ */
+static unsigned insn_cycles(const uint8_t *p, size_t size)
+{
+    uint16_t hw1 = p[0] | (p[1] << 8);
+    uint16_t hw2;
+
+    if (size == 2) {
+        if ((hw1 & 0xF800) == 0x4800 || (hw1 & 0xF000) == 0x5000 ||
+            (hw1 & 0xE000) == 0x6000 || (hw1 & 0xE000) == 0x8000)
+            return 2; // load/store single
+        if ((hw1 & 0xF600) == 0xB400)
+            return 1 + (__builtin_popcount(hw1 & 0x1FF) + 1) / 2; // push/pop
+        if ((hw1 & 0xF000) == 0xC000)
+            return 1 + (__builtin_popcount(hw1 & 0xFF) + 1) / 2; // ldm/stm
+        if ((hw1 & 0xFF00) == 0x4700)
+            return 3; // bx/blx
+        if ((hw1 & 0xF000) == 0xD000 || (hw1 & 0xF800) == 0xE000 || (hw1 & 0xF500) == 0xB100)
+            return 2; // b, cbz/cbnz
+        return 1;
+    }
+
+    hw2 = p[2] | (p[3] << 8);
+    if ((hw1 & 0xF800) == 0xF000 && (hw2 & 0x8000))
+        return (hw2 & 0x4000) ? 3 : 2; // bl, b
+    if ((hw1 & 0xFE00) == 0xF800)
+        return 2; // load/store single
+    if ((hw1 & 0xFE40) == 0xE800)
+        return 1 + (__builtin_popcount(hw2) + 1) / 2; // ldm/stm
+    if ((hw1 & 0xFE40) == 0xE840)
+        return 2; // ldrd/strd, tbb/tbh
+    if ((hw1 & 0xFFD0) == 0xFB90)
+        return 8; // sdiv/udiv: 2...12
+    if ((hw1 & 0xEE00) == 0xEC00)
+        return 2; // vldr/vstr, vpush/vpop
+    if ((hw1 & 0xFFB0) == 0xEE80 && (hw2 & 0x0E50) == 0x0A00)
+        return 14; // vdiv
+    return 1;
+}
+
+static struct node *child_of(struct node *parent, const struct sym *func)
+{
+    struct node *n;
+
+    for (n = parent->child; n; n = n->next) {
+        if (n->func == func)
+            return n;
+    }
+    n = g_new0(struct node, 1);
+    n->func = func;
+    n->next = parent->child;
+    parent->child = n;
+    return n;
+}
+
+static struct node *task_top(struct task *t)
+{
+    return t->depth ? t->stack[t->depth - 1] : &t->root;
+}
+
+/*
+ * Follow the calls: a block at the start of a function is a call (or a tail
+ * call, or an exception entry), a block in a function already on the stack is
+ * a return to it, any other block replaces the top of the stack
+ */
+static void task_enter(struct task *t, const struct tb_info *tb)
+{
+    struct node *top_node = task_top(t);
+    int i;
+
+    if (tb->entry) {
+        if (t->depth == MAX_DEPTH)
+            t->depth--;
+        t->stack[t->depth] = child_of(task_top(t), tb->func);
+        t->depth++;
+        return;
+    }
+    if (top_node->func == tb->func)
+        return;
+    for (i = t->depth - 1; i >= 0; i--) {
+        if (t->stack[i]->func == tb->func) {
+            t->depth = i + 1;
+            return;
+        }
+    }
+    if (t->depth)
+        t->depth--;
+    t->stack[t->depth] = child_of(task_top(t), tb->func);
+    t->depth++;
+}
+
+static uint32_t read_reg(struct vcpu *v, struct qemu_plugin_register *reg)
+{
+    g_byte_array_set_size(v->buf, 0);
+    if (qemu_plugin_read_register(reg, v->buf) < 4)
+        return 0;
+    return v->buf->data[0] | (v->buf->data[1] << 8) | (v->buf->data[2] << 16) |
+           ((uint32_t)v->buf->data[3] << 24);
+}
+
+// Task whose stack contains the resumed PSP, or a new one
+static struct task *task_resumed(struct vcpu *v, uint32_t psp)
+{
+    struct task *best = NULL;
+
+    for (int i = 0; i < v->num_tasks; i++) {
+        struct task *t = &v->tasks[i];
+
+        if (t->psp && t->psp <= psp && psp - t->psp <= MAX_FRAME_SIZE &&
+            (!best || t->psp > best->psp))
+            best = t;
+    }
+    if (best)
+        return best;
+    if (v->num_tasks == MAX_TASKS)
+        return &v->tasks[MAX_TASKS - 1];
+    return &v->tasks[v->num_tasks++];
+}
+
+static void vcpu_tb_exec(unsigned int vcpu_index, void *udata)
+{
+    struct vcpu *v = *(struct vcpu **)qemu_plugin_scoreboard_find(vcpus, vcpu_index);
+    const struct tb_info *tb = udata;
+    struct node *n;
+
+    if (v->psp_reg && tb->context_switch && !v->switching) {
+        // The startup code is never resumed
+        if (v->cur != &v->tasks[0])
+            v->cur->psp = read_reg(v, v->psp_reg);
+        v->switching = true;
+    } else if (v->switching && !(read_reg(v, v->xpsr_reg) & 0x1FF)) {
+        // Back in thread mode (IPSR is 0): the switch is over
+        v->cur = task_resumed(v, read_reg(v, v->psp_reg));
+        v->switching = false;
+    }
+
+    task_enter(v->cur, tb);
+    n = task_top(v->cur);
+    n->insns += tb->insns;
+    n->cycles += tb->cycles;
+}
+
+static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
+{
+    uint32_t pc = qemu_plugin_tb_vaddr(tb);
+    size_t n = qemu_plugin_tb_n_insns(tb);
+    struct tb_info *info;
+
+    g_mutex_lock(&tbs_lock);
+    info = g_hash_table_lookup(tbs, GUINT_TO_POINTER(pc));
+    if (!info || info->insns != n) {
+        info = g_new0(struct tb_info, 1);
+        info->pc = pc;
+        info->func = find_func(pc);
+        info->entry = info->func->addr == pc && info->func != &unknown_func;
+        info->context_switch = info->entry &&
+                               (info->func == switch_funcs[0] || info->func == switch_funcs[1]);
+        info->insns = n;
+        for (size_t i = 0; i < n; i++) {
+            struct qemu_plugin_insn *insn = qemu_plugin_tb_get_insn(tb, i);
+            uint8_t data[4] = { 0 };
+            size_t size = qemu_plugin_insn_data(insn, data, sizeof(data));
+
+            info->cycles += insn_cycles(data, size);
+        }
+        g_hash_table_insert(tbs, GUINT_TO_POINTER(pc), info);
+    }
+    g_mutex_unlock(&tbs_lock);
+
+    qemu_plugin_register_vcpu_tb_exec_cb(tb, vcpu_tb_exec, QEMU_PLUGIN_CB_R_REGS, info);
+}
+
+static void vcpu_init(qemu_plugin_id_t id, unsigned int vcpu_index)
+{
+    struct vcpu *v = g_new0(struct vcpu, 1);
+    g_autoptr(GArray) regs = qemu_plugin_get_registers();
+
+    for (guint i = 0; i < regs->len; i++) {
+        qemu_plugin_reg_descriptor *rd = &g_array_index(regs, qemu_plugin_reg_descriptor, i);
+
+        if (!strcmp(rd->name, "psp"))
+            v->psp_reg = rd->handle;
+        else if (!strcmp(rd->name, "xpsr"))
+            v->xpsr_reg = rd->handle;
+    }
+    if (!v->xpsr_reg)
+        v->psp_reg = NULL;
+    v->buf = g_byte_array_new();
+    // Code executed before the scheduler starts
+    v->num_tasks = 1;
+    v->cur = &v->tasks[0];
+    *(struct vcpu **)qemu_plugin_scoreboard_find(vcpus, vcpu_index) = v;
+}
+
+static void node_totals(const struct node *n, uint64_t *insns, uint64_t *cycles)
+{
+    *insns += n->insns;
+    *cycles += n->cycles;
+    for (const struct node *c = n->child; c; c = c->next)
+        node_totals(c, insns, cycles);
+}
+
+static void write_folded(FILE *f, const struct node *n, GString *path)
+{
+    gsize len = path->len;
+    uint64_t w = weight_insns ? n->insns : n->cycles;
+
+    if (n->func) {
+        if (path->len)
+            g_string_append_c(path, ';');
+        g_string_append(path, n->func->name);
+        if (w)
+            fprintf(f, "%s %" PRIu64 "\n", path->str, w);
+    }
+    for (const struct node *c = n->child; c; c = c->next)
+        write_folded(f, c, path);
+    g_string_truncate(path, len);
+}
+
+// Self counts of each function, over all the call paths
+static void func_totals(const struct node *n, GHashTable *totals)
+{
+    if (n->func) {
+        uint64_t *t = g_hash_table_lookup(totals, n->func);
+
+        if (!t) {
+            t = g_new0(uint64_t, 2);
+            g_hash_table_insert(totals, (gpointer)n->func, t);
+        }
+        t[0] += n->insns;
+        t[1] += n->cycles;
+    }
+    for (const struct node *c = n->child; c; c = c->next)
+        func_totals(c, totals);
+}
+
+static gint totals_cmp(gconstpointer a, gconstpointer b, gpointer totals)
+{
+    const uint64_t *ta = g_hash_table_lookup(totals, *(gpointer *)a);
+    const uint64_t *tb = g_hash_table_lookup(totals, *(gpointer *)b);
+    int i = weight_insns ? 0 : 1;
+
+    return ta[i] < tb[i] ? 1 : ta[i] > tb[i] ? -1 : 0;
+}
+
+static void plugin_exit(qemu_plugin_id_t id, void *p)
+{
+    g_autoptr(GString) report = g_string_new("");
+    g_autoptr(GHashTable) totals = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+    g_autoptr(GString) path = g_string_new("");
+    g_autoptr(GPtrArray) sorted = g_ptr_array_new();
+    int num_vcpus = qemu_plugin_num_vcpus();
+    FILE *f = fopen(out_path, "w");
+
+    if (!f)
+        fprintf(stderr, "s32k358_prof: cannot write %s\n", out_path);
+
+    g_string_append_printf(report, "%-8s %-24s %16s %16s\n", "cpu", "task", "insns", "cycles");
+    for (int i = 0; i < num_vcpus; i++) {
+        struct vcpu *v = *(struct vcpu **)qemu_plugin_scoreboard_find(vcpus, i);
+
+        if (!v)
+            continue;
+        for (int j = 0; j < v->num_tasks; j++) {
+            struct task *t = &v->tasks[j];
+            uint64_t insns = 0, cycles = 0;
+            // A task is named after the outermost function of its call tree
+            const char *name = j == 0 ? "[startup]" :
+                               t->root.child ? t->root.child->func->name : "[task]";
+
+            node_totals(&t->root, &insns, &cycles);
+            g_string_append_printf(report, "%-8d %-24s %16" PRIu64 " %16" PRIu64 "\n",
+                                   i, name, insns, cycles);
+            func_totals(&t->root, totals);
+            if (f) {
+                g_string_truncate(path, 0);
+                if (num_vcpus > 1)
+                    g_string_printf(path, "cpu%d", i);
+                write_folded(f, &t->root, path);
+            }
+        }
+    }
+    if (f)
+        fclose(f);
+
+    g_string_append_printf(report, "\n%-32s %16s %16s\n", "function", "insns", "cycles");
+    {
+        GHashTableIter it;
+        gpointer key;
+
+        g_hash_table_iter_init(&it, totals);
+        while (g_hash_table_iter_next(&it, &key, NULL))
+            g_ptr_array_add(sorted, key);
+    }
+    g_ptr_array_sort_with_data(sorted, totals_cmp, totals);
+    for (guint i = 0; i < sorted->len && i < (guint)top; i++) {
+        const struct sym *fn = g_ptr_array_index(sorted, i);
+        const uint64_t *t = g_hash_table_lookup(totals, fn);
+
+        g_string_append_printf(report, "%-32s %16" PRIu64 " %16" PRIu64 "\n",
+                               fn->name, t[0], t[1]);
+    }
+
+    if (report_path) {
+        if (!g_file_set_contents(report_path, report->str, report->len, NULL))
+            fprintf(stderr, "s32k358_prof: cannot write %s\n", report_path);
+    } else {
+        qemu_plugin_outs(report->str);
+    }
+}
+
+QEMU_PLUGIN_EXPORT int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
+                                           int argc, char **argv)
+{
+    const char *elf_path = NULL;
+
+    for (int i = 0; i < argc; i++) {
+        g_auto(GStrv) tokens = g_strsplit(argv[i], "=", 2);
+
+        if (!tokens[1]) {
+            fprintf(stderr, "s32k358_prof: option parsing failed: %s\n", argv[i]);
+            return -1;
+        }
+        if (!strcmp(tokens[0], "elf")) {
+            elf_path = g_strdup(tokens[1]);
+        } else if (!strcmp(tokens[0], "out")) {
+            out_path = g_strdup(tokens[1]);
+        } else if (!strcmp(tokens[0], "report")) {
+            report_path = g_strdup(tokens[1]);
+        } else if (!strcmp(tokens[0], "weight") &&
+                   (!strcmp(tokens[1], "insns") || !strcmp(tokens[1], "cycles"))) {
+            weight_insns = !strcmp(tokens[1], "insns");
+        } else if (!strcmp(tokens[0], "top")) {
+            top = atoi(tokens[1]);
+        } else {
+            fprintf(stderr, "s32k358_prof: option parsing failed: %s\n", argv[i]);
+            return -1;
+        }
+    }
+    if (!elf_path) {
+        fprintf(stderr, "s32k358_prof: the firmware ELF is required (elf=<file>)\n");
+        return -1;
+    }
+    if (!syms_load(elf_path, STT_FUNC, &funcs))
+        return -1;
+    if (!funcs.n) {
+        fprintf(stderr, "s32k358_prof: no function symbols in %s\n", elf_path);
+        return -1;
+    }
+    switch_funcs[0] = syms_find_by_name(&funcs, "xPortPendSVHandler");
+    switch_funcs[1] = syms_find_by_name(&funcs, "vPortSVCHandler");
+
+    tbs = g_hash_table_new(NULL, NULL);
+    vcpus = qemu_plugin_scoreboard_new(sizeof(struct vcpu *));
+    qemu_plugin_register_vcpu_init_cb(id, vcpu_init);
+    qemu_plugin_register_vcpu_tb_trans_cb(id, vcpu_tb_trans);
+    qemu_plugin_register_atexit_cb(id, plugin_exit, NULL);
+    return 0;
+}
@@ -0,0 +1,120 @@
+/*
+ * Symbols of the s32k358 firmware ELF, shared by the TCG plugins
+ *
+ * SPDX-License-Identifier: CC-BY-NC-4.0
+ * Copyright (c) 2025 Braidotti Sara, Iorio Chiara, Pani Matteo.
+ *
+ */
+
+#ifndef S32K358_SYMS_H
+#define S32K358_SYMS_H
+
+#include <elf.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+struct sym {
+    uint32_t addr;
+    uint32_t size;
+    const char *name;
+};
+
+// Symbols sorted by address
+struct syms {
+    struct sym *v;
+    size_t n;
+};
+
+static int sym_cmp(const void *a, const void *b)
+{
+    const struct sym *sa = a, *sb = b;
+
+    return sa->addr < sb->addr ? -1 : sa->addr > sb->addr;
+}
+
+// Read the symbols of type stt (STT_FUNC, STT_OBJECT...) of an ELF32 little endian file
+static inline bool syms_load(const char *path, int stt, struct syms *s)
+{
+    g_autoptr(GError) err = NULL;
+    gchar *data;
+    gsize len;
+    const Elf32_Ehdr *eh;
+    const Elf32_Shdr *sh;
+
+    if (!g_file_get_contents(path, &data, &len, &err)) {
+        fprintf(stderr, "s32k358 plugin: %s\n", err->message);
+        return false;
+    }
+    eh = (const Elf32_Ehdr *)data;
+    if (len < sizeof(*eh) || memcmp(eh->e_ident, ELFMAG, SELFMAG) ||
+        eh->e_ident[EI_CLASS] != ELFCLASS32 || eh->e_ident[EI_DATA] != ELFDATA2LSB ||
+        eh->e_shoff + (gsize)eh->e_shnum * sizeof(*sh) > len) {
+        fprintf(stderr, "s32k358 plugin: %s is not a 32 bits little endian ELF\n", path);
+        g_free(data);
+        return false;
+    }
+    sh = (const Elf32_Shdr *)(data + eh->e_shoff);
+
+    s->v = NULL;
+    s->n = 0;
+    for (int i = 0; i < eh->e_shnum; i++) {
+        const Elf32_Sym *sym = (const Elf32_Sym *)(data + sh[i].sh_offset);
+        const char *strtab;
+        size_t n;
+
+        if (sh[i].sh_type != SHT_SYMTAB || sh[i].sh_link >= eh->e_shnum)
+            continue;
+        strtab = data + sh[sh[i].sh_link].sh_offset;
+        n = sh[i].sh_size / sizeof(*sym);
+        s->v = g_renew(struct sym, s->v, s->n + n);
+        for (size_t j = 0; j < n; j++) {
+            if (ELF32_ST_TYPE(sym[j].st_info) != stt || !sym[j].st_value || !sym[j].st_name)
+                continue;
+            // Sections not loaded in memory are usually linked at 0 and would shadow the ITCM
+            if (sym[j].st_shndx >= eh->e_shnum || !(sh[sym[j].st_shndx].sh_flags & SHF_ALLOC))
+                continue;
+            // Bit 0 of a Thumb function address is set
+            s->v[s->n].addr = stt == STT_FUNC ? sym[j].st_value & ~1u : sym[j].st_value;
+            s->v[s->n].size = sym[j].st_size;
+            s->v[s->n].name = g_strdup(strtab + sym[j].st_name);
+            s->n++;
+        }
+    }
+    g_free(data);
+    qsort(s->v, s->n, sizeof(*s->v), sym_cmp);
+    return true;
+}
+
+// Symbol containing addr (a symbol without size extends to the next one)
+static inline const struct sym *syms_find(const struct syms *s, uint32_t addr)
+{
+    size_t lo = 0, hi = s->n;
+
+    if (!s->n || addr < s->v[0].addr)
+        return NULL;
+    // Last symbol starting at or before addr
+    while (hi - lo > 1) {
+        size_t mid = (lo + hi) / 2;
+
+        if (s->v[mid].addr <= addr)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    if (s->v[lo].size && addr >= s->v[lo].addr + s->v[lo].size)
+        return NULL;
+    return &s->v[lo];
+}
+
+static inline const struct sym *syms_find_by_name(const struct syms *s, const char *name)
+{
+    for (size_t i = 0; i < s->n; i++) {
+        if (!strcmp(s->v[i].name, name))
+            return &s->v[i];
+    }
+    return NULL;
+}
+
+#endif
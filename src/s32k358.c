@@ -23,29 +23,96 @@
 #include "qom/object.h" // QEMU Object Model
 #include "hw/char/s32k358_uart.h" // LPUART s32k358
 #include "hw/timer/s32k358_timer.h" // PIT s32k358
+#include "hw/arm/s32k358_edma.h" // eDMA and DMAMUX s32k358
+#include "hw/arm/s32k358_flash.h" // Data flash and its controller s32k358
+#include "hw/arm/s32k358_cgm.h" // Clock generation s32k358
+#include "hw/arm/s32k358_mscm.h" // Inter-core interrupts and interrupt router s32k358
+#include "hw/arm/s32k358_trace.h" // ITM and DWT s32k358
+#include "target/arm/arm-powerctl.h" // Start and stop of the second core
+#include "qemu/log.h" // Guest errors
+#include "qemu/main-loop.h" // Bottom halves
+#include "qemu/timer.h" // Virtual clock
+#include "sysemu/runstate.h" // Shutdown requests
+#include "migration/snapshot.h" // Internal snapshots
+#include "sysemu/hostmem.h" // Memory backends
+#include "sysemu/cpu-timers.h" // Instruction counting (icount)
+#include "hw/core/cpu.h" // Current CPU
+#include "migration/vmstate.h" // State of the machine in the snapshots
 
 // Data types representing the machine
 struct S32K358MachineClass {
     MachineClass parent;
 };
 
+// Line buffers of the code flash, each holding FLASH_LINE_SIZE bytes
+#define FLASH_LINE_BUFFERS  4
+
+// Memory accessed through the wait-state timing model
+typedef struct S32K358TimedMem {
+    struct S32K358MachineState *mms;
+    MemoryRegion *mr; // ROM device, whose RAM holds the data
+    uint32_t *ws; // wait states of an access
+    bool flash; // read-only, with the prefetch buffers
+    // Each core has its own flash port, so its own line buffers
+    uint64_t lines[S32K358_MAX_CPUS][FLASH_LINE_BUFFERS];
+    int32_t next_line[S32K358_MAX_CPUS];
+} S32K358TimedMem;
+
+// Peripheral whose registers are accessed through the wait-state timing model
+typedef struct S32K358TimedPeriph {
+    struct S32K358MachineState *mms;
+    MemoryRegion iomem;
+    MemoryRegion *target; // registers of the peripheral
+} S32K358TimedPeriph;
+
 struct S32K358MachineState {
     MachineState parent;
-    ARMv7MState armv7m; // CPU
+    ARMv7MState armv7m[S32K358_MAX_CPUS]; // CPUs: CM7_0 and CM7_2
+    MemoryRegion cm7_2_memory; // address space of CM7_2: its own TCMs over the system memory
+    MemoryRegion cm7_2_system;
+    S32K358MSCM mscm;
+    S32K358Trace trace; // ITM and DWT of each core
     MemoryRegion utest;
-    MemoryRegion cflash0; // Code flash
-    MemoryRegion cflash1;
-    MemoryRegion cflash2;
-    MemoryRegion cflash3;
-    MemoryRegion dflash0; // Data flash
+    MemoryRegion cflash; // Code flash (the four blocks are contiguous)
+    HostMemoryBackend *flash_backend; // optional backend of the code flash
     MemoryRegion itcm0; // memory located in 0x0, here we put the interrupt vector table
     MemoryRegion dtcm0;
+    MemoryRegion itcm2; // TCMs of CM7_2, at the same local addresses
+    MemoryRegion dtcm2;
+    MemoryRegion tcm_backdoor[4]; // aliases of the TCMs in the system memory
     MemoryRegion sram0; // RAM
     MemoryRegion sram1;
     MemoryRegion sram2;
     S32K358Timer timer[3];
-    Clock *sysclk; // Clock
+    S32K358EDMA edma;
+    S32K358DFlash dflash; // Data flash and its program/erase controller
+    HostMemoryBackend *dflash_backend; // optional backend of the data flash
+    S32K358CGM cgm; // Clock generation (FXOSC, PLL, MC_CGM)
+    Clock *sysclk; // CORE_CLK, output of the clock generation
     Clock *refclk;
+    // Test control device
+    MemoryRegion testctl;
+    QEMUBH *snapshot_bh;
+    char *snapshot_name;
+    bool snapshot_pending;
+    int64_t reset_ns; // virtual time of the last reset
+    uint32_t cycles_hi; // upper half of the cycle counter, latched when the lower half is read
+    // MC_ME core control
+    MemoryRegion mc_me;
+    uint32_t me_key; // first half of the key sequence
+    uint32_t me_pconf[3];
+    uint32_t me_pupd[3];
+    uint32_t me_addr[3];
+    // Wait-state timing model
+    bool wait_states;
+    uint32_t flash_ws;
+    uint32_t sram_ws;
+    uint32_t periph_ws;
+    int64_t ws_rem_ns[S32K358_MAX_CPUS]; // wait time shorter than one instruction, not charged yet
+    S32K358TimedMem timed_cflash;
+    S32K358TimedMem timed_sram[3];
+    S32K358TimedPeriph timed_uart[16];
+    S32K358TimedPeriph timed_timer[3];
 };
 
 #define TYPE_S32K358_MACHINE MACHINE_TYPE_NAME("s32k358")
@@ -53,10 +120,13 @@ struct S32K358MachineState {
 OBJECT_DECLARE_TYPE(S32K358MachineState, S32K358MachineClass, S32K358_MACHINE)
 
 
-/* Main SYSCLK frequency in Hz */
-/* Accordimg to the documentation, it can run up to 240 MHz */
-/* We found this value in the offical freeRTOS demo for s32k3x8 */
-#define SYSCLK_FRQ 24000000
+/*
+ * Frequency of the crystal of the S32K3X8EVB board in Hz.
+ * After reset the core runs from FIRC at 24 MHz (the value of the
+ * offical freeRTOS demo for s32k3x8); the firmware can switch it to the
+ * PLL, up to 240 MHz
+ */
+#define FXOSC_FRQ 16000000
 
 /*
  * The Application Notes don't say anything about how the
@@ -67,6 +137,13 @@ OBJECT_DECLARE_TYPE(S32K358MachineState, S32K358MachineClass, S32K358_MACHINE)
  */
 #define REFCLK_FRQ (1 * 1000 * 1000)
 
+// The NVIC of the S32K3 implements 4 priority bits: 16 levels, in the upper nibble of each byte
+#define NUM_PRIO_BITS 4
+
+/* Code flash: blocks 0...3 of 2 MB each */
+#define CFLASH_BASE 0x00400000
+#define CFLASH_SIZE (8 * MiB)
+
 /* Initialize the auxiliary RAM region @mr and map it into
  * the memory map at @base.
  */
@@ -77,17 +154,418 @@ static void make_ram(MemoryRegion *system_memory, MemoryRegion *mr,
     memory_region_add_subregion(system_memory, base, mr);
 }
 
+/*
+ * Wait-state timing model. With the "wait-states" property the accesses of the
+ * CPUs to the code flash and to the SRAM go through the callbacks of ROM devices
+ * (the loader still writes the images directly, see s32k358_reset()), and the
+ * ones to the PIT and LPUART registers through a proxy region. Their wait states
+ * are taken from the instructions the CPU may still run before the next timer
+ * deadline, so that they advance the virtual clock seen by the firmware (PIT,
+ * SysTick, DWT) without delaying the deadline. The TCMs have no wait states
+ * and stay plain RAM. The accesses of the eDMA are not charged.
+ */
+#define FLASH_LINE_SIZE     32
+
+static void s32k358_ws_charge(S32K358MachineState *mms, uint32_t cycles)
+{
+    CPUState *cs = current_cpu;
+    int64_t ns, insn_ns, n, take;
+    int cpu;
+
+    if (!cycles || !cs || !icount_enabled())
+        return;
+    cpu = cs->cpu_index;
+    insn_ns = icount_to_ns(1);
+    ns = clock_ticks_to_ns(mms->sysclk, cycles) + mms->ws_rem_ns[cpu];
+    n = ns / insn_ns;
+    mms->ws_rem_ns[cpu] = ns % insn_ns;
+
+    /*
+     * Executed instructions are counted as the budget minus the instructions
+     * left (icount_extra plus the decrementer), which run up to the next timer
+     * deadline: taking the wait from them keeps the deadline in place.
+     */
+    take = MIN(n, cs->icount_extra);
+    cs->icount_extra -= take;
+    n -= take;
+    take = MIN(n, cs->neg.icount_decr.u16.low);
+    cs->neg.icount_decr.u16.low -= take;
+    n -= take;
+    // A wait longer than the instructions left overshoots the deadline by the rest
+    cs->icount_budget += n;
+}
+
+// A line not found in the buffers costs the wait states; the next line is always prefetched
+static uint32_t s32k358_ws_flash_cycles(S32K358TimedMem *t, hwaddr addr)
+{
+    uint64_t line = addr / FLASH_LINE_SIZE;
+    int cpu = current_cpu ? current_cpu->cpu_index : 0;
+    uint64_t *lines = t->lines[cpu];
+    int32_t *next_line = &t->next_line[cpu];
+    bool hit = false, next = false;
+    int i;
+
+    for (i = 0; i < FLASH_LINE_BUFFERS; i++) {
+        hit |= lines[i] == line;
+        next |= lines[i] == line + 1;
+    }
+    if (!hit) {
+        lines[*next_line] = line;
+        *next_line = (*next_line + 1) % FLASH_LINE_BUFFERS;
+    }
+    if (!next) {
+        lines[*next_line] = line + 1;
+        *next_line = (*next_line + 1) % FLASH_LINE_BUFFERS;
+    }
+    return hit ? 0 : *t->ws;
+}
+
+static MemTxResult s32k358_ws_mem_read(void *opaque, hwaddr addr, uint64_t *data,
+                                       unsigned size, MemTxAttrs attrs)
+{
+    S32K358TimedMem *t = opaque;
+
+    *data = ldn_le_p((uint8_t *)memory_region_get_ram_ptr(t->mr) + addr, size);
+    // The accesses of the CPUs have specified attributes, the ones of the eDMA do not
+    if (!attrs.unspecified)
+        s32k358_ws_charge(t->mms, t->flash ? s32k358_ws_flash_cycles(t, addr) : *t->ws);
+    return MEMTX_OK;
+}
+
+static MemTxResult s32k358_ws_mem_write(void *opaque, hwaddr addr, uint64_t data,
+                                        unsigned size, MemTxAttrs attrs)
+{
+    S32K358TimedMem *t = opaque;
+
+    if (t->flash) {
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "S32K358: write to the read-only code flash at offset 0x%x\n", (int)addr);
+        return MEMTX_OK;
+    }
+    stn_le_p((uint8_t *)memory_region_get_ram_ptr(t->mr) + addr, size, data);
+    memory_region_set_dirty(t->mr, addr, size);
+    if (!attrs.unspecified)
+        s32k358_ws_charge(t->mms, *t->ws);
+    return MEMTX_OK;
+}
+
+static const MemoryRegionOps s32k358_ws_mem_ops = {
+    .read_with_attrs = s32k358_ws_mem_read,
+    .write_with_attrs = s32k358_ws_mem_write,
+    .endianness = DEVICE_LITTLE_ENDIAN,
+    .valid.min_access_size = 1,
+    .valid.max_access_size = 8,
+    .impl.min_access_size = 1,
+    .impl.max_access_size = 4,
+};
+
+static MemTxResult s32k358_ws_periph_read(void *opaque, hwaddr addr, uint64_t *data,
+                                          unsigned size, MemTxAttrs attrs)
+{
+    S32K358TimedPeriph *p = opaque;
+
+    // The wait states elapse before the register is read
+    if (!attrs.unspecified)
+        s32k358_ws_charge(p->mms, p->mms->periph_ws);
+    return memory_region_dispatch_read(p->target, addr, data, size_memop(size) | MO_TE, attrs);
+}
+
+static MemTxResult s32k358_ws_periph_write(void *opaque, hwaddr addr, uint64_t data,
+                                           unsigned size, MemTxAttrs attrs)
+{
+    S32K358TimedPeriph *p = opaque;
+
+    if (!attrs.unspecified)
+        s32k358_ws_charge(p->mms, p->mms->periph_ws);
+    return memory_region_dispatch_write(p->target, addr, data, size_memop(size) | MO_TE, attrs);
+}
+
+static const MemoryRegionOps s32k358_ws_periph_ops = {
+    .read_with_attrs = s32k358_ws_periph_read,
+    .write_with_attrs = s32k358_ws_periph_write,
+    .endianness = DEVICE_NATIVE_ENDIAN,
+    .valid.min_access_size = 1,
+    .valid.max_access_size = 4,
+};
+
+/*
+ * Memory of the CPUs: plain RAM, or a ROM device accessed through the
+ * wait-state timing model in timing mode
+ */
+static void make_timed_mem(S32K358MachineState *mms, S32K358TimedMem *t, MemoryRegion *mr,
+                           const char *name, hwaddr base, hwaddr size, uint32_t *ws)
+{
+    if (!mms->wait_states) {
+        make_ram(get_system_memory(), mr, name, base, size);
+        return;
+    }
+    t->mms = mms;
+    t->mr = mr;
+    t->ws = ws;
+    memory_region_init_rom_device(mr, NULL, &s32k358_ws_mem_ops, t, name, size, &error_fatal);
+    memory_region_add_subregion(get_system_memory(), base, mr);
+}
+
+// Map the registers of a peripheral, through the wait-state timing model in timing mode
+static void map_timed_periph(S32K358MachineState *mms, S32K358TimedPeriph *p,
+                             SysBusDevice *sbd, hwaddr base)
+{
+    if (!mms->wait_states) {
+        sysbus_mmio_map(sbd, 0, base);
+        return;
+    }
+    p->mms = mms;
+    p->target = sysbus_mmio_get_region(sbd, 0);
+    memory_region_init_io(&p->iomem, OBJECT(mms), &s32k358_ws_periph_ops, p,
+                          memory_region_name(p->target), memory_region_size(p->target));
+    memory_region_add_subregion(get_system_memory(), base, &p->iomem);
+}
+
+// In ROM mode the timed memories are read directly, as RAM
+static void s32k358_ws_set_romd(S32K358MachineState *mms, bool romd)
+{
+    if (!mms->wait_states)
+        return;
+    memory_region_rom_device_set_romd(mms->timed_cflash.mr, romd);
+    for (int i = 0; i < ARRAY_SIZE(mms->timed_sram); i++)
+        memory_region_rom_device_set_romd(mms->timed_sram[i].mr, romd);
+}
+
+/*
+ * Test control device: it is not part of the MCU, it allows the firmware
+ * under test to control the emulator (e.g. to end a test run)
+ */
+#define TESTCTL_BASE        0x40600000
+#define TESTCTL_EXIT        0x0 // write: exit QEMU with the written status code
+#define TESTCTL_SNAPSHOT    0x4 // write: save an internal snapshot; read: 1 until it is saved
+#define TESTCTL_CYCLES_LO   0x8 // read: CORE_CLK cycles since reset (latches the upper half)
+#define TESTCTL_CYCLES_HI   0xC // read: upper half latched by CYCLES_LO
+
+static uint64_t s32k358_testctl_read(void *opaque, hwaddr offset, unsigned size)
+{
+    S32K358MachineState *mms = S32K358_MACHINE(opaque);
+    uint64_t cycles;
+
+    switch (offset) {
+    case TESTCTL_SNAPSHOT:
+        return mms->snapshot_pending;
+    case TESTCTL_CYCLES_LO:
+        cycles = clock_ns_to_ticks(mms->sysclk,
+                                   qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) - mms->reset_ns);
+        mms->cycles_hi = cycles >> 32;
+        return (uint32_t)cycles;
+    case TESTCTL_CYCLES_HI:
+        return mms->cycles_hi;
+    default:
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "S32K358 test control read: bad offset 0x%x\n", (int)offset);
+        return 0;
+    }
+}
+
+static void s32k358_testctl_write(void *opaque, hwaddr offset, uint64_t value,
+                                  unsigned size)
+{
+    S32K358MachineState *mms = S32K358_MACHINE(opaque);
+
+    switch (offset) {
+    case TESTCTL_EXIT:
+        qemu_system_shutdown_request_with_code(SHUTDOWN_CAUSE_GUEST_SHUTDOWN, value);
+        break;
+    case TESTCTL_SNAPSHOT:
+        // The snapshot stops the VM: it is taken from the main loop, not inside the vCPU access
+        mms->snapshot_pending = true;
+        qemu_bh_schedule(mms->snapshot_bh);
+        break;
+    default:
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "S32K358 test control write: bad offset 0x%x\n", (int)offset);
+        break;
+    }
+}
+
+static const MemoryRegionOps s32k358_testctl_ops = {
+    .read = s32k358_testctl_read,
+    .write = s32k358_testctl_write,
+    .endianness = DEVICE_NATIVE_ENDIAN,
+    .valid.min_access_size = 4,
+    .valid.max_access_size = 4,
+};
+
+/*
+ * MC_ME: only the core control of partition 0 is modeled, to let CM7_0
+ * start CM7_2 at the boot address written in PRTN0_CORE2_ADDR
+ */
+#define MC_ME_BASE          0x402DC000
+#define MC_ME_CTL_KEY       0x0
+#define MC_ME_KEY           0x5AF0
+#define MC_ME_INVERTED_KEY  0xA50F
+#define MC_ME_CORE(n)       (0x140 + 0x20 * (n)) // PRTN0_COREn registers
+#define MC_ME_CORE_PCONF    0x0 // bit 0 CCE: core clock enable
+#define MC_ME_CORE_PUPD     0x4 // bit 0 CCUPD: apply PCONF with the next key sequence
+#define MC_ME_CORE_STAT     0x8 // bit 0 CCS: core clock status
+#define MC_ME_CORE_ADDR     0xC // boot address (vector table)
+#define MC_ME_NUM_CORES     3 // CM7_0, CM7_1 (lockstep checker) and CM7_2
+
+// Start or stop CM7_2 according to PRTN0_CORE2_PCONF[CCE]
+static void s32k358_mc_me_update_cm7_2(S32K358MachineState *mms)
+{
+    ARMCPU *cpu;
+
+    if (MACHINE(mms)->smp.cpus < 2) {
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "S32K358 MC_ME: CM7_2 is not emulated (it needs -smp 2)\n");
+        return;
+    }
+    cpu = mms->armv7m[1].cpu;
+    if ((mms->me_pconf[2] & 1) && cpu->power_state == PSCI_OFF) {
+        // The core fetches SP and PC from the vector table at the boot address
+        cpu->init_nsvtor = mms->me_addr[2];
+        arm_set_cpu_on_and_reset(cpu->mp_affinity);
+    } else if (!(mms->me_pconf[2] & 1) && cpu->power_state == PSCI_ON) {
+        arm_set_cpu_off(cpu->mp_affinity);
+    }
+}
+
+static uint64_t s32k358_mc_me_read(void *opaque, hwaddr offset, unsigned size)
+{
+    S32K358MachineState *mms = S32K358_MACHINE(opaque);
+    int n = (offset - MC_ME_CORE(0)) / 0x20;
+
+    if (offset >= MC_ME_CORE(0) && offset < MC_ME_CORE(MC_ME_NUM_CORES)) {
+        switch ((offset - MC_ME_CORE(0)) % 0x20) {
+        case MC_ME_CORE_PCONF:
+            return mms->me_pconf[n];
+        case MC_ME_CORE_PUPD:
+            return mms->me_pupd[n];
+        case MC_ME_CORE_STAT:
+            // CM7_0 and its checker always run
+            if (n < 2)
+                return 1;
+            return MACHINE(mms)->smp.cpus > 1 && mms->armv7m[1].cpu->power_state == PSCI_ON;
+        case MC_ME_CORE_ADDR:
+            return mms->me_addr[n];
+        }
+    }
+    if (offset == MC_ME_CTL_KEY)
+        return 0;
+    qemu_log_mask(LOG_UNIMP,
+                  "S32K358 MC_ME read: unimplemented offset 0x%x\n", (int)offset);
+    return 0;
+}
+
+static void s32k358_mc_me_write(void *opaque, hwaddr offset, uint64_t value,
+                                unsigned size)
+{
+    S32K358MachineState *mms = S32K358_MACHINE(opaque);
+    int n = (offset - MC_ME_CORE(0)) / 0x20;
+
+    if (offset == MC_ME_CTL_KEY) {
+        // The configuration is applied by the key followed by the inverted key
+        if (value == MC_ME_INVERTED_KEY && mms->me_key == MC_ME_KEY) {
+            for (n = 0; n < MC_ME_NUM_CORES; n++) {
+                if (mms->me_pupd[n] && n == 2)
+                    s32k358_mc_me_update_cm7_2(mms);
+                mms->me_pupd[n] = 0;
+            }
+        }
+        mms->me_key = value;
+        return;
+    }
+    if (offset >= MC_ME_CORE(0) && offset < MC_ME_CORE(MC_ME_NUM_CORES)) {
+        switch ((offset - MC_ME_CORE(0)) % 0x20) {
+        case MC_ME_CORE_PCONF:
+            mms->me_pconf[n] = value & 1;
+            return;
+        case MC_ME_CORE_PUPD:
+            mms->me_pupd[n] = value & 1;
+            return;
+        case MC_ME_CORE_STAT:
+            qemu_log_mask(LOG_GUEST_ERROR,
+                          "S32K358 MC_ME write: write to Read-Only offset 0x%x\n", (int)offset);
+            return;
+        case MC_ME_CORE_ADDR:
+            mms->me_addr[n] = value & ~3;
+            return;
+        }
+    }
+    qemu_log_mask(LOG_UNIMP,
+                  "S32K358 MC_ME write: unimplemented offset 0x%x\n", (int)offset);
+}
+
+static const MemoryRegionOps s32k358_mc_me_ops = {
+    .read = s32k358_mc_me_read,
+    .write = s32k358_mc_me_write,
+    .endianness = DEVICE_NATIVE_ENDIAN,
+    .valid.min_access_size = 4,
+    .valid.max_access_size = 4,
+};
+
+static void s32k358_testctl_snapshot(void *opaque)
+{
+    S32K358MachineState *mms = S32K358_MACHINE(opaque);
+    Error *err = NULL;
+
+    if (!save_snapshot(mms->snapshot_name, true, NULL, false, NULL, &err)) {
+        error_report_err(err);
+    }
+    mms->snapshot_pending = false;
+}
+
+/*
+ * State of the machine itself (test control cycle counter and MC_ME core
+ * control); the power state of CM7_2 is saved with the CPU
+ */
+static bool s32k358_wait_states_needed(void *opaque)
+{
+    S32K358MachineState *mms = opaque;
+
+    return mms->wait_states;
+}
+
+// Prefetch buffers of the code flash and wait times not charged yet
+static const VMStateDescription vmstate_s32k358_wait_states = {
+    .name = "s32k358-machine/wait-states",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .needed = s32k358_wait_states_needed,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT64_2DARRAY(timed_cflash.lines, S32K358MachineState,
+                               S32K358_MAX_CPUS, FLASH_LINE_BUFFERS),
+        VMSTATE_INT32_ARRAY(timed_cflash.next_line, S32K358MachineState, S32K358_MAX_CPUS),
+        VMSTATE_INT64_ARRAY(ws_rem_ns, S32K358MachineState, S32K358_MAX_CPUS),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static const VMStateDescription vmstate_s32k358_machine = {
+    .name = "s32k358-machine",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (const VMStateField[]) {
+        VMSTATE_INT64(reset_ns, S32K358MachineState),
+        VMSTATE_UINT32(cycles_hi, S32K358MachineState),
+        VMSTATE_UINT32(me_key, S32K358MachineState),
+        VMSTATE_UINT32_ARRAY(me_pconf, S32K358MachineState, 3),
+        VMSTATE_UINT32_ARRAY(me_pupd, S32K358MachineState, 3),
+        VMSTATE_UINT32_ARRAY(me_addr, S32K358MachineState, 3),
+        VMSTATE_END_OF_LIST()
+    },
+    .subsections = (const VMStateDescription * const []) {
+        &vmstate_s32k358_wait_states,
+        NULL
+    }
+};
+
 static void s32k358_init(MachineState *machine)
 {
     S32K358MachineState *mms = S32K358_MACHINE(machine);
     MemoryRegion *system_memory = get_system_memory();
     DeviceState *armv7m;
-    int i;
+    DeviceState *mscm;
+    int i, n;
 
     /* This clock doesn't need migration because it is fixed-frequency */
-    mms->sysclk = clock_new(OBJECT(machine), "SYSCLK");
-    clock_set_hz(mms->sysclk, SYSCLK_FRQ);
-
     mms->refclk = clock_new(OBJECT(machine), "REFCLK");
     clock_set_hz(mms->refclk, REFCLK_FRQ);
 
@@ -98,31 +576,185 @@ static void s32k358_init(MachineState *machine)
      * Create the memory region, add it to the memory regions of the system and finally link it to the CPU
     */
 
+    if (mms->wait_states && !icount_enabled()) {
+        warn_report("s32k358: the wait states are charged only with -icount");
+    }
+
     make_ram(system_memory, &mms->itcm0, "s32k358.itcm0", 0x00000000, 0x10000);
-    make_ram(system_memory, &mms->cflash0, "s32k358.cflash0", 0x00400000, 0x200000);
-    make_ram(system_memory, &mms->cflash1, "s32k358.cflash1", 0x00600000, 0x200000);
-    make_ram(system_memory, &mms->cflash2, "s32k358.cflash2", 0x00800000, 0x200000);
-    make_ram(system_memory, &mms->cflash3, "s32k358.cflash3", 0x00A00000, 0x200000);
-    make_ram(system_memory, &mms->dflash0, "s32k358.dflash0", 0x10000000, 0x20000);
+    /*
+     * The code flash is read-only for the guest and TCG executes directly from it.
+     * With the "flash" property the memory backend (e.g. a file with the image,
+     * mapped in memory without copying it) is used in place of an empty ROM
+     */
+    if (mms->flash_backend) {
+        MemoryRegion *mr = host_memory_backend_get_memory(mms->flash_backend);
+
+        if (mms->wait_states) {
+            error_report("s32k358: the wait-state timing model does not support the code flash backend");
+            exit(1);
+        }
+
+        if (host_memory_backend_is_mapped(mms->flash_backend)) {
+            error_report("s32k358: memory backend %s is already in use",
+                         object_get_canonical_path_component(OBJECT(mms->flash_backend)));
+            exit(1);
+        }
+        if (memory_region_size(mr) > CFLASH_SIZE) {
+            error_report("s32k358: the code flash backend is larger than 8 MB");
+            exit(1);
+        }
+        // The loader cannot write the image of -kernel in a read-only mapping
+        if (machine->kernel_filename && memory_region_is_rom(mr)) {
+            error_report("s32k358: -kernel cannot be loaded in a read-only code flash backend");
+            exit(1);
+        }
+        memory_region_set_readonly(mr, true);
+        host_memory_backend_set_mapped(mms->flash_backend, true);
+        memory_region_add_subregion(system_memory, CFLASH_BASE, mr);
+    } else if (mms->wait_states) {
+        mms->timed_cflash.flash = true;
+        make_timed_mem(mms, &mms->timed_cflash, &mms->cflash, "s32k358.cflash",
+                       CFLASH_BASE, CFLASH_SIZE, &mms->flash_ws);
+    } else {
+        memory_region_init_rom(&mms->cflash, NULL, "s32k358.cflash", CFLASH_SIZE, &error_fatal);
+        memory_region_add_subregion(system_memory, CFLASH_BASE, &mms->cflash);
+    }
     make_ram(system_memory, &mms->dtcm0, "s32k358.dtcm0", 0x20000000, 0x20000);
     make_ram(system_memory, &mms->utest, "s32k358.utest", 0x1B000000, 0x2000);
-    make_ram(system_memory, &mms->sram0, "s32k358.sram0", 0x20400000, 0x40000);
-    make_ram(system_memory, &mms->sram1, "s32k358.sram1", 0x20440000, 0x40000);
-    make_ram(system_memory, &mms->sram2, "s32k358.sram2", 0x20480000, 0x40000);
-
-    // CPU: arm-cortex-m7
-    object_initialize_child(OBJECT(mms), "armv7m", &mms->armv7m, TYPE_ARMV7M);
-    armv7m = DEVICE(&mms->armv7m);
-    // Number of interrupts (see interrupt map)
-    qdev_prop_set_uint32(armv7m, "num-irq", 240);
-
-    qdev_connect_clock_in(armv7m, "cpuclk", mms->sysclk);
-    qdev_connect_clock_in(armv7m, "refclk", mms->refclk);
-    qdev_prop_set_string(armv7m, "cpu-type", machine->cpu_type);
-    qdev_prop_set_bit(armv7m, "enable-bitband", true);
-    object_property_set_link(OBJECT(&mms->armv7m), "memory",
+    // TCMs of CM7_2: they are mapped only in its address space
+    memory_region_init_ram(&mms->itcm2, NULL, "s32k358.itcm2", 0x10000, &error_fatal);
+    memory_region_init_ram(&mms->dtcm2, NULL, "s32k358.dtcm2", 0x20000, &error_fatal);
+    // Backdoor addresses, from which every master (e.g. the other core) reaches the TCMs
+    memory_region_init_alias(&mms->tcm_backdoor[0], NULL, "s32k358.itcm0-backdoor",
+                             &mms->itcm0, 0, 0x10000);
+    memory_region_add_subregion(system_memory, 0x11000000, &mms->tcm_backdoor[0]);
+    memory_region_init_alias(&mms->tcm_backdoor[1], NULL, "s32k358.itcm2-backdoor",
+                             &mms->itcm2, 0, 0x10000);
+    memory_region_add_subregion(system_memory, 0x11800000, &mms->tcm_backdoor[1]);
+    memory_region_init_alias(&mms->tcm_backdoor[2], NULL, "s32k358.dtcm0-backdoor",
+                             &mms->dtcm0, 0, 0x20000);
+    memory_region_add_subregion(system_memory, 0x21000000, &mms->tcm_backdoor[2]);
+    memory_region_init_alias(&mms->tcm_backdoor[3], NULL, "s32k358.dtcm2-backdoor",
+                             &mms->dtcm2, 0, 0x20000);
+    memory_region_add_subregion(system_memory, 0x21800000, &mms->tcm_backdoor[3]);
+    // CM7_2 sees its own TCMs in place of the ones of CM7_0
+    memory_region_init(&mms->cm7_2_memory, NULL, "s32k358.cm7_2-memory", UINT64_MAX);
+    memory_region_init_alias(&mms->cm7_2_system, NULL, "s32k358.cm7_2-system",
+                             system_memory, 0, UINT64_MAX);
+    memory_region_add_subregion_overlap(&mms->cm7_2_memory, 0, &mms->cm7_2_system, 0);
+    memory_region_add_subregion_overlap(&mms->cm7_2_memory, 0x00000000, &mms->itcm2, 1);
+    memory_region_add_subregion_overlap(&mms->cm7_2_memory, 0x20000000, &mms->dtcm2, 1);
+    make_timed_mem(mms, &mms->timed_sram[0], &mms->sram0, "s32k358.sram0", 0x20400000, 0x40000,
+                   &mms->sram_ws);
+    make_timed_mem(mms, &mms->timed_sram[1], &mms->sram1, "s32k358.sram1", 0x20440000, 0x40000,
+                   &mms->sram_ws);
+    make_timed_mem(mms, &mms->timed_sram[2], &mms->sram2, "s32k358.sram2", 0x20480000, 0x40000,
+                   &mms->sram_ws);
+
+    // Clock generation: it feeds the CPU, the PIT timers and the LPUARTs
+    object_initialize_child(OBJECT(mms), "cgm", &mms->cgm, TYPE_S32K358_CGM);
+    qdev_prop_set_uint32(DEVICE(&mms->cgm), "fxosc-frq", FXOSC_FRQ);
+    sysbus_realize(SYS_BUS_DEVICE(&mms->cgm), &error_fatal);
+    sysbus_mmio_map(SYS_BUS_DEVICE(&mms->cgm), 0, 0x402D4000); // FXOSC
+    sysbus_mmio_map(SYS_BUS_DEVICE(&mms->cgm), 1, 0x402D8000); // MC_CGM_0
+    sysbus_mmio_map(SYS_BUS_DEVICE(&mms->cgm), 2, 0x402E0000); // PLL
+    mms->sysclk = qdev_get_clock_out(DEVICE(&mms->cgm), "core_clk");
+
+    /*
+     * CPUs: arm-cortex-m7. CM7_0 (with its lockstep checker CM7_1, not emulated)
+     * and, with -smp 2, CM7_2, which stays off until CM7_0 starts it through the MC_ME
+     */
+    for (i = 0; i < machine->smp.cpus; i++) {
+        object_initialize_child(OBJECT(mms), i ? "armv7m-cm7_2" : "armv7m",
+                                &mms->armv7m[i], TYPE_ARMV7M);
+        armv7m = DEVICE(&mms->armv7m[i]);
+        // Number of interrupts (see interrupt map)
+        qdev_prop_set_uint32(armv7m, "num-irq", S32K358_MSCM_NUM_IRQ);
+        qdev_prop_set_uint8(armv7m, "num-prio-bits", NUM_PRIO_BITS);
+
+        qdev_connect_clock_in(armv7m, "cpuclk", mms->sysclk);
+        qdev_connect_clock_in(armv7m, "refclk", mms->refclk);
+        qdev_prop_set_string(armv7m, "cpu-type", machine->cpu_type);
+        qdev_prop_set_bit(armv7m, "enable-bitband", true);
+        if (i) {
+            qdev_prop_set_bit(armv7m, "start-powered-off", true);
+            object_property_set_link(OBJECT(armv7m), "memory",
+                                     OBJECT(&mms->cm7_2_memory), &error_abort);
+        } else {
+            // A flash image without -kernel carries its vector table at the start of the flash
+            if (mms->flash_backend && !machine->kernel_filename) {
+                qdev_prop_set_uint32(armv7m, "init-nsvtor", CFLASH_BASE);
+            }
+            object_property_set_link(OBJECT(armv7m), "memory",
+                                     OBJECT(system_memory), &error_abort);
+        }
+        sysbus_realize(SYS_BUS_DEVICE(armv7m), &error_fatal);
+    }
+
+    /*
+     * ITM and DWT: mapped in the PPB of each core over the placeholders of the armv7m,
+     * the stimulus ports of both cores go to the same SWO chardev
+     */
+    object_initialize_child(OBJECT(mms), "trace", &mms->trace, TYPE_S32K358_TRACE);
+    qdev_connect_clock_in(DEVICE(&mms->trace), "cpuclk", mms->sysclk);
+    sysbus_realize(SYS_BUS_DEVICE(&mms->trace), &error_fatal);
+    for (i = 0; i < machine->smp.cpus; i++) {
+        memory_region_add_subregion_overlap(&mms->armv7m[i].container, S32K358_ITM_BASE,
+                                            sysbus_mmio_get_region(SYS_BUS_DEVICE(&mms->trace), 2 * i),
+                                            1);
+        memory_region_add_subregion_overlap(&mms->armv7m[i].container, S32K358_DWT_BASE,
+                                            sysbus_mmio_get_region(SYS_BUS_DEVICE(&mms->trace), 2 * i + 1),
+                                            1);
+    }
+
+    // MSCM: routes the peripheral interrupts to the cores and generates the inter-core ones
+    object_initialize_child(OBJECT(mms), "mscm", &mms->mscm, TYPE_S32K358_MSCM);
+    mscm = DEVICE(&mms->mscm);
+    qdev_prop_set_uint32(mscm, "num-cpu", machine->smp.cpus);
+    sysbus_realize(SYS_BUS_DEVICE(mscm), &error_fatal);
+    sysbus_mmio_map(SYS_BUS_DEVICE(mscm), 0, 0x40260000);
+    for (i = 0; i < machine->smp.cpus; i++) {
+        g_autofree char *name = g_strdup_printf("cpu%d-irq", i);
+
+        for (n = 0; n < S32K358_MSCM_NUM_IRQ; n++) {
+            qdev_connect_gpio_out_named(mscm, name, n,
+                                        qdev_get_gpio_in(DEVICE(&mms->armv7m[i]), n));
+        }
+    }
+
+    // MC_ME core control
+    memory_region_init_io(&mms->mc_me, OBJECT(mms), &s32k358_mc_me_ops, mms,
+                          "s32k358-mc-me", 0x4000);
+    memory_region_add_subregion(system_memory, MC_ME_BASE, &mms->mc_me);
+    vmstate_register(NULL, 0, &vmstate_s32k358_machine, mms);
+
+    // eDMA - TCD pages of channels 0..11 and 12..31 are in two different blocks (see memory map)
+    object_initialize_child(OBJECT(mms), "edma", &mms->edma, TYPE_S32K358_EDMA);
+    object_property_set_link(OBJECT(&mms->edma), "memory",
                              OBJECT(system_memory), &error_abort);
-    sysbus_realize(SYS_BUS_DEVICE(&mms->armv7m), &error_fatal);
+    sysbus_realize(SYS_BUS_DEVICE(&mms->edma), &error_fatal);
+    sysbus_mmio_map(SYS_BUS_DEVICE(&mms->edma), S32K358_EDMA_MMIO_MGMT, 0x4020C000);
+    for (i = 0; i < S32K358_EDMA_NUM_CHANNELS; i++) {
+        hwaddr tcdbase = i < 12 ? 0x40210000 + i * 0x4000 : 0x40410000 + (i - 12) * 0x4000;
+
+        sysbus_mmio_map(SYS_BUS_DEVICE(&mms->edma), S32K358_EDMA_MMIO_TCD(i), tcdbase);
+        // irq from the s32kxxrm interrupt map (DMATCD0 ... DMATCD31)
+        sysbus_connect_irq(SYS_BUS_DEVICE(&mms->edma), i, qdev_get_gpio_in_named(mscm, "irq", 4 + i));
+    }
+    sysbus_mmio_map(SYS_BUS_DEVICE(&mms->edma), S32K358_EDMA_MMIO_DMAMUX(0), 0x40280000);
+    sysbus_mmio_map(SYS_BUS_DEVICE(&mms->edma), S32K358_EDMA_MMIO_DMAMUX(1), 0x40284000);
+
+    // Data flash - PFC and FMU registers; the completion irq is in the s32kxxrm interrupt map
+    object_initialize_child(OBJECT(mms), "dflash", &mms->dflash, TYPE_S32K358_DFLASH);
+    if (mms->dflash_backend) {
+        object_property_set_link(OBJECT(&mms->dflash), "memdev",
+                                 OBJECT(mms->dflash_backend), &error_abort);
+    }
+    sysbus_realize(SYS_BUS_DEVICE(&mms->dflash), &error_fatal);
+    sysbus_mmio_map(SYS_BUS_DEVICE(&mms->dflash), 0, S32K358_DFLASH_BASE);
+    sysbus_mmio_map(SYS_BUS_DEVICE(&mms->dflash), 1, 0x40268000);
+    sysbus_mmio_map(SYS_BUS_DEVICE(&mms->dflash), 2, 0x402EC000);
+    sysbus_connect_irq(SYS_BUS_DEVICE(&mms->dflash), 0, qdev_get_gpio_in_named(mscm, "irq", 48));
 
     // UART
     static const hwaddr uartbase[] = {0x40328000, 0x4032C000, 0x40330000, 0x40334000,
@@ -140,11 +772,21 @@ static void s32k358_init(MachineState *machine)
         dev = qdev_new(TYPE_S32K358_LPUART);
         s = SYS_BUS_DEVICE(dev);
         qdev_prop_set_chr(dev, "chardev", serial_hd(i));
-        qdev_prop_set_uint32(dev, "pclk-frq", SYSCLK_FRQ);
+        // LPUART0, LPUART1 and LPUART8 are clocked by AIPS_PLAT_CLK, the others by AIPS_SLOW_CLK
+        qdev_connect_clock_in(dev, "pclk",
+                              qdev_get_clock_out(DEVICE(&mms->cgm),
+                                                 i == 0 || i == 1 || i == 8 ? "aips_plat_clk" : "aips_slow_clk"));
         qdev_prop_set_uint32(dev, "id", i);
         sysbus_realize_and_unref(s, &error_fatal);
-        sysbus_mmio_map(s, 0, uartbase[i]);
-        sysbus_connect_irq(s, 0, qdev_get_gpio_in(armv7m, uartirq_base + i));
+        map_timed_periph(mms, &mms->timed_uart[i], s, uartbase[i]);
+        sysbus_connect_irq(s, 0, qdev_get_gpio_in_named(mscm, "irq", uartirq_base + i));
+        // DMA requests, routed by the DMAMUX
+        qdev_connect_gpio_out_named(dev, "dma-rx-req", 0,
+                                    qdev_get_gpio_in_named(DEVICE(&mms->edma), "dma-req",
+                                                           S32K358_DMAMUX_LPUART_RX_SOURCE(i)));
+        qdev_connect_gpio_out_named(dev, "dma-tx-req", 0,
+                                    qdev_get_gpio_in_named(DEVICE(&mms->edma), "dma-req",
+                                                           S32K358_DMAMUX_LPUART_TX_SOURCE(i)));
     }
 
     // Timers - refer to page 2816 of the manual (68.7.1)
@@ -160,17 +802,93 @@ static void s32k358_init(MachineState *machine)
         object_initialize_child(OBJECT(mms), name, &mms->timer[i],
                                 TYPE_S32K358_TIMER);
         sbd = SYS_BUS_DEVICE(&mms->timer[i]);
-        qdev_connect_clock_in(DEVICE(&mms->timer[i]), "pclk", mms->sysclk);
+        qdev_connect_clock_in(DEVICE(&mms->timer[i]), "pclk",
+                              qdev_get_clock_out(DEVICE(&mms->cgm), "aips_slow_clk"));
         sysbus_realize_and_unref(sbd, &error_fatal);
-        sysbus_mmio_map(sbd, 0, timerbase[i]);
-        sysbus_connect_irq(sbd, 0, qdev_get_gpio_in(armv7m, irqno[i]));
+        map_timed_periph(mms, &mms->timed_timer[i], sbd, timerbase[i]);
+        sysbus_connect_irq(sbd, 0, qdev_get_gpio_in_named(mscm, "irq", irqno[i]));
     }
 
+    // Test control device
+    memory_region_init_io(&mms->testctl, OBJECT(mms), &s32k358_testctl_ops, mms,
+                          "s32k358.testctl", 0x10);
+    memory_region_add_subregion(system_memory, TESTCTL_BASE, &mms->testctl);
+    mms->snapshot_bh = qemu_bh_new(s32k358_testctl_snapshot, mms);
+
     // Address from which load the kernel
     // The address specified here is usually not used
     // (only if it's not specified in the elf file)
     armv7m_load_kernel(ARM_CPU(first_cpu), machine->kernel_filename,
-                       0x00400000, 0x200000);
+                       CFLASH_BASE, CFLASH_SIZE);
+}
+
+static void s32k358_reset(MachineState *machine, ShutdownCause reason)
+{
+    S32K358MachineState *mms = S32K358_MACHINE(machine);
+
+    // The loader writes the images in the timed memories in ROM mode
+    s32k358_ws_set_romd(mms, true);
+    qemu_devices_reset(reason);
+    s32k358_ws_set_romd(mms, false);
+    memset(mms->timed_cflash.lines, 0xff, sizeof(mms->timed_cflash.lines));
+    memset(mms->timed_cflash.next_line, 0, sizeof(mms->timed_cflash.next_line));
+    memset(mms->ws_rem_ns, 0, sizeof(mms->ws_rem_ns));
+    mms->me_key = 0;
+    // CM7_0 and its checker run out of reset, CM7_2 is off
+    mms->me_pconf[0] = 1;
+    mms->me_pconf[1] = 1;
+    mms->me_pconf[2] = 0;
+    memset(mms->me_pupd, 0, sizeof(mms->me_pupd));
+    memset(mms->me_addr, 0, sizeof(mms->me_addr));
+    mms->reset_ns = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+}
+
+static char *s32k358_get_snapshot_name(Object *obj, Error **errp)
+{
+    S32K358MachineState *mms = S32K358_MACHINE(obj);
+
+    return g_strdup(mms->snapshot_name);
+}
+
+static void s32k358_set_snapshot_name(Object *obj, const char *value, Error **errp)
+{
+    S32K358MachineState *mms = S32K358_MACHINE(obj);
+
+    g_free(mms->snapshot_name);
+    mms->snapshot_name = g_strdup(value);
+}
+
+static bool s32k358_get_wait_states(Object *obj, Error **errp)
+{
+    S32K358MachineState *mms = S32K358_MACHINE(obj);
+
+    return mms->wait_states;
+}
+
+static void s32k358_set_wait_states(Object *obj, bool value, Error **errp)
+{
+    S32K358MachineState *mms = S32K358_MACHINE(obj);
+
+    mms->wait_states = value;
+}
+
+static void s32k358_instance_init(Object *obj)
+{
+    S32K358MachineState *mms = S32K358_MACHINE(obj);
+
+    mms->snapshot_name = g_strdup("checkpoint");
+
+    // Wait states of the timing model, in CORE_CLK cycles
+    mms->flash_ws = 5;
+    mms->sram_ws = 1;
+    mms->periph_ws = 2;
+    object_property_add_uint32_ptr(obj, "flash-ws", &mms->flash_ws, OBJ_PROP_FLAG_READWRITE);
+    object_property_set_description(obj, "flash-ws",
+                                    "Wait states of a code flash access missing the prefetch buffers");
+    object_property_add_uint32_ptr(obj, "sram-ws", &mms->sram_ws, OBJ_PROP_FLAG_READWRITE);
+    object_property_set_description(obj, "sram-ws", "Wait states of an SRAM access");
+    object_property_add_uint32_ptr(obj, "periph-ws", &mms->periph_ws, OBJ_PROP_FLAG_READWRITE);
+    object_property_set_description(obj, "periph-ws", "Wait states of a PIT or LPUART register access");
 }
 
 // Machine init
@@ -179,15 +897,36 @@ static void s32k358_class_init(ObjectClass *oc, void *data)
     MachineClass *mc = MACHINE_CLASS(oc);
 
     mc->init = s32k358_init;
-    mc->max_cpus = 1;
+    mc->reset = s32k358_reset;
+    mc->max_cpus = S32K358_MAX_CPUS;
     mc->default_cpu_type = ARM_CPU_TYPE_NAME("cortex-m7");
     mc->desc = "ARM S32K358";
+
+    object_class_property_add_link(oc, "flash", TYPE_MEMORY_BACKEND,
+                                   offsetof(S32K358MachineState, flash_backend),
+                                   object_property_allow_set_link, OBJ_PROP_LINK_STRONG);
+    object_class_property_set_description(oc, "flash",
+                                          "Memory backend of the code flash (e.g. memory-backend-file with the image)");
+    object_class_property_add_link(oc, "dflash", TYPE_MEMORY_BACKEND,
+                                   offsetof(S32K358MachineState, dflash_backend),
+                                   object_property_allow_set_link, OBJ_PROP_LINK_STRONG);
+    object_class_property_set_description(oc, "dflash",
+                                          "Memory backend of the data flash (e.g. a shared memory-backend-file)");
+    object_class_property_add_str(oc, "snapshot-name", s32k358_get_snapshot_name,
+                                  s32k358_set_snapshot_name);
+    object_class_property_set_description(oc, "snapshot-name",
+                                          "Tag of the snapshot requested by the test control device");
+    object_class_property_add_bool(oc, "wait-states", s32k358_get_wait_states,
+                                   s32k358_set_wait_states);
+    object_class_property_set_description(oc, "wait-states",
+                                          "Charge the wait states of flash, SRAM and peripheral accesses (with -icount)");
 }
 
 static const TypeInfo s32k358_info = {
     .name = TYPE_S32K358_MACHINE,
     .parent = TYPE_MACHINE,
     .instance_size = sizeof(S32K358MachineState),
+    .instance_init = s32k358_instance_init,
     .class_size = sizeof(S32K358MachineClass),
     .class_init = s32k358_class_init,
 };
@@ -0,0 +1,431 @@
+/*
+ * S32K358 clock generation (FXOSC, PLL and MC_CGM) emulation
+ *
+ * SPDX-License-Identifier: CC-BY-NC-4.0
+ * Copyright (c) 2025 Braidotti Sara, Iorio Chiara, Pani Matteo.
+ *
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/log.h"
+#include "qemu/module.h"
+#include "qemu/host-utils.h"
+#include "qapi/error.h"
+#include "hw/sysbus.h"
+#include "hw/qdev-clock.h"
+#include "hw/qdev-properties.h"
+#include "hw/registerfields.h"
+#include "hw/arm/s32k358_cgm.h"
+#include "migration/vmstate.h"
+
+// FXOSC registers
+REG32(FXOSC_CTRL, 0x0)
+    FIELD(FXOSC_CTRL, OSCON, 0, 1) // crystal oscillator enable
+REG32(FXOSC_STAT, 0x4)
+    FIELD(FXOSC_STAT, OSC_STAT, 31, 1) // the oscillator is stable
+
+// MC_CGM_0 registers: only the clock source multiplexer 0 (core and AIPS clocks)
+REG32(MUX_0_CSC, 0x300) // clock source control
+    FIELD(MUX_0_CSC, CLK_SW, 2, 1) // switch to the source of SELCTL
+    FIELD(MUX_0_CSC, SAFE_SW, 3, 1) // switch to the safe clock (FIRC)
+    FIELD(MUX_0_CSC, SELCTL, 24, 6)
+REG32(MUX_0_CSS, 0x304) // clock source status
+    FIELD(MUX_0_CSS, CLK_SW, 2, 1)
+    FIELD(MUX_0_CSS, SAFE_SW, 3, 1)
+    FIELD(MUX_0_CSS, SWIP, 16, 1) // switch in progress
+    FIELD(MUX_0_CSS, SWTRG, 17, 3) // switch trigger cause
+    FIELD(MUX_0_CSS, SELSTAT, 24, 6)
+REG32(MUX_0_DC_0, 0x308) // divider control: CORE_CLK
+REG32(MUX_0_DC_6, 0x320)
+    FIELD(MUX_0_DC, DIV, 16, 8)
+    FIELD(MUX_0_DC, DE, 31, 1)
+REG32(MUX_0_DIV_TRIG_CTRL, 0x334)
+REG32(MUX_0_DIV_TRIG, 0x338)
+REG32(MUX_0_DIV_UPD_STAT, 0x33C)
+
+// PLL registers
+REG32(PLLCR, 0x0)
+    FIELD(PLLCR, PLLPD, 31, 1) // power down
+REG32(PLLSR, 0x4)
+    FIELD(PLLSR, LOCK, 2, 1)
+REG32(PLLDV, 0x8)
+    FIELD(PLLDV, MFI, 0, 8) // integer part of the multiplier
+    FIELD(PLLDV, RDIV, 12, 3) // input divider
+    FIELD(PLLDV, ODIV2, 25, 6) // output divider
+REG32(PLLFD, 0x10)
+    FIELD(PLLFD, MFN, 0, 15) // numerator of the fractional part of the multiplier
+REG32(PLLODIV_0, 0x80)
+REG32(PLLODIV_1, 0x84)
+    FIELD(PLLODIV, DIV, 16, 8)
+    FIELD(PLLODIV, DE, 31, 1)
+
+// Sources of the clock multiplexer 0
+#define MUX_0_SRC_FIRC      0
+#define MUX_0_SRC_PLL_PHI0  8
+
+// Trigger causes reported in MUX_0_CSS[SWTRG]
+#define SWTRG_SWITCH_OK     1
+#define SWTRG_SWITCH_FAIL   2
+#define SWTRG_SAFE          4
+
+// Denominator of the fractional part of the PLL multiplier
+#define PLL_MFN_DEN         18432
+
+static uint64_t s32k358_cgm_fxosc_hz(S32K358CGM *s)
+{
+    return (s->fxosc_ctrl & R_FXOSC_CTRL_OSCON_MASK) ? s->fxosc_frq : 0;
+}
+
+static bool s32k358_cgm_pll_locked(S32K358CGM *s)
+{
+    return !(s->pllcr & R_PLLCR_PLLPD_MASK) && s32k358_cgm_fxosc_hz(s) &&
+           FIELD_EX32(s->plldv, PLLDV, MFI);
+}
+
+// PLL_PHIn = FXOSC * (MFI + MFN / 18432) / RDIV / ODIV2 / (PLLODIV_n[DIV] + 1)
+static uint64_t s32k358_cgm_pll_phi_hz(S32K358CGM *s, int n)
+{
+    uint32_t rdiv = MAX(FIELD_EX32(s->plldv, PLLDV, RDIV), 1);
+    uint32_t odiv2 = MAX(FIELD_EX32(s->plldv, PLLDV, ODIV2), 1);
+    uint64_t vco;
+
+    if (!s32k358_cgm_pll_locked(s) || !(s->pllodiv[n] & R_PLLODIV_DE_MASK))
+        return 0;
+
+    vco = muldiv64(s32k358_cgm_fxosc_hz(s),
+                   FIELD_EX32(s->plldv, PLLDV, MFI) * PLL_MFN_DEN + FIELD_EX32(s->pllfd, PLLFD, MFN),
+                   PLL_MFN_DEN * rdiv);
+    return vco / odiv2 / (FIELD_EX32(s->pllodiv[n], PLLODIV, DIV) + 1);
+}
+
+static uint64_t s32k358_cgm_source_hz(S32K358CGM *s, uint32_t sel)
+{
+    switch (sel) {
+    case MUX_0_SRC_FIRC:
+        return S32K358_FIRC_FRQ;
+    case MUX_0_SRC_PLL_PHI0:
+        return s32k358_cgm_pll_phi_hz(s, 0);
+    default:
+        return 0;
+    }
+}
+
+// Recompute the output clocks; the consumers are notified only when propagating
+static void s32k358_cgm_update(S32K358CGM *s, bool propagate)
+{
+    Clock *out[] = {s->core_clk, s->aips_plat_clk, s->aips_slow_clk};
+    uint64_t src = s32k358_cgm_source_hz(s, FIELD_EX32(s->mux0_css, MUX_0_CSS, SELSTAT));
+
+    for (int i = 0; i < ARRAY_SIZE(out); i++) {
+        uint64_t hz = 0;
+
+        if (s->mux0_dc[i] & R_MUX_0_DC_DE_MASK)
+            hz = src / (FIELD_EX32(s->mux0_dc[i], MUX_0_DC, DIV) + 1);
+        if (propagate)
+            clock_update_hz(out[i], hz);
+        else
+            clock_set_hz(out[i], hz);
+    }
+}
+
+static uint64_t s32k358_fxosc_read(void *opaque, hwaddr offset, unsigned size)
+{
+    S32K358CGM *s = S32K358_CGM(opaque);
+
+    switch (offset) {
+    case A_FXOSC_CTRL:
+        return s->fxosc_ctrl;
+    case A_FXOSC_STAT:
+        // The crystal is stable as soon as it is enabled
+        return (s->fxosc_ctrl & R_FXOSC_CTRL_OSCON_MASK) ? R_FXOSC_STAT_OSC_STAT_MASK : 0;
+    default:
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "S32K358 FXOSC read: bad offset 0x%x\n", (int)offset);
+        return 0;
+    }
+}
+
+static void s32k358_fxosc_write(void *opaque, hwaddr offset, uint64_t value,
+                                unsigned size)
+{
+    S32K358CGM *s = S32K358_CGM(opaque);
+
+    switch (offset) {
+    case A_FXOSC_CTRL:
+        s->fxosc_ctrl = value;
+        s32k358_cgm_update(s, true);
+        break;
+    case A_FXOSC_STAT:
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "S32K358 FXOSC write: write to Read-Only offset 0x%x\n", (int)offset);
+        break;
+    default:
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "S32K358 FXOSC write: bad offset 0x%x\n", (int)offset);
+        break;
+    }
+}
+
+static const MemoryRegionOps s32k358_fxosc_ops = {
+    .read = s32k358_fxosc_read,
+    .write = s32k358_fxosc_write,
+    .endianness = DEVICE_NATIVE_ENDIAN,
+    .valid.min_access_size = 4,
+    .valid.max_access_size = 4,
+};
+
+static uint64_t s32k358_mc_cgm_read(void *opaque, hwaddr offset, unsigned size)
+{
+    S32K358CGM *s = S32K358_CGM(opaque);
+
+    switch (offset) {
+    case A_MUX_0_CSC:
+        return s->mux0_csc;
+    case A_MUX_0_CSS:
+        return s->mux0_css;
+    case A_MUX_0_DC_0 ... A_MUX_0_DC_6:
+        return s->mux0_dc[(offset - A_MUX_0_DC_0) / 4];
+    case A_MUX_0_DIV_TRIG_CTRL:
+        return s->mux0_div_trig_ctrl;
+    case A_MUX_0_DIV_TRIG:
+        return 0;
+    case A_MUX_0_DIV_UPD_STAT:
+        // The dividers are updated immediately
+        return 0;
+    default:
+        qemu_log_mask(LOG_UNIMP,
+                      "S32K358 MC_CGM read: unimplemented offset 0x%x\n", (int)offset);
+        return 0;
+    }
+}
+
+static void s32k358_mc_cgm_write(void *opaque, hwaddr offset, uint64_t value,
+                                 unsigned size)
+{
+    S32K358CGM *s = S32K358_CGM(opaque);
+    uint32_t sel;
+
+    switch (offset) {
+    case A_MUX_0_CSC:
+        // The switch requests are self-clearing
+        s->mux0_csc = value & ~(R_MUX_0_CSC_CLK_SW_MASK | R_MUX_0_CSC_SAFE_SW_MASK);
+        if (value & R_MUX_0_CSC_SAFE_SW_MASK) {
+            s->mux0_css = FIELD_DP32(s->mux0_css, MUX_0_CSS, SELSTAT, MUX_0_SRC_FIRC);
+            s->mux0_css = FIELD_DP32(s->mux0_css, MUX_0_CSS, SWTRG, SWTRG_SAFE);
+            s->mux0_css |= R_MUX_0_CSS_SAFE_SW_MASK;
+        } else if (value & R_MUX_0_CSC_CLK_SW_MASK) {
+            // The switch is completed at once: SWIP is never seen set
+            sel = FIELD_EX32(value, MUX_0_CSC, SELCTL);
+            if (s32k358_cgm_source_hz(s, sel)) {
+                s->mux0_css = FIELD_DP32(s->mux0_css, MUX_0_CSS, SELSTAT, sel);
+                s->mux0_css = FIELD_DP32(s->mux0_css, MUX_0_CSS, SWTRG, SWTRG_SWITCH_OK);
+                s->mux0_css &= ~R_MUX_0_CSS_SAFE_SW_MASK;
+            } else {
+                qemu_log_mask(LOG_GUEST_ERROR,
+                              "S32K358 MC_CGM: clock source %u of MUX_0 is not running\n", sel);
+                s->mux0_css = FIELD_DP32(s->mux0_css, MUX_0_CSS, SWTRG, SWTRG_SWITCH_FAIL);
+            }
+            s->mux0_css |= R_MUX_0_CSS_CLK_SW_MASK;
+        }
+        s32k358_cgm_update(s, true);
+        break;
+    case A_MUX_0_DC_0 ... A_MUX_0_DC_6:
+        s->mux0_dc[(offset - A_MUX_0_DC_0) / 4] = value & (R_MUX_0_DC_DE_MASK | R_MUX_0_DC_DIV_MASK);
+        s32k358_cgm_update(s, true);
+        break;
+    case A_MUX_0_DIV_TRIG_CTRL:
+        s->mux0_div_trig_ctrl = value;
+        break;
+    case A_MUX_0_DIV_TRIG:
+        // The new divider values are already in use
+        break;
+    case A_MUX_0_CSS:
+    case A_MUX_0_DIV_UPD_STAT:
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "S32K358 MC_CGM write: write to Read-Only offset 0x%x\n", (int)offset);
+        break;
+    default:
+        qemu_log_mask(LOG_UNIMP,
+                      "S32K358 MC_CGM write: unimplemented offset 0x%x\n", (int)offset);
+        break;
+    }
+}
+
+static const MemoryRegionOps s32k358_mc_cgm_ops = {
+    .read = s32k358_mc_cgm_read,
+    .write = s32k358_mc_cgm_write,
+    .endianness = DEVICE_NATIVE_ENDIAN,
+    .valid.min_access_size = 4,
+    .valid.max_access_size = 4,
+};
+
+static uint64_t s32k358_pll_read(void *opaque, hwaddr offset, unsigned size)
+{
+    S32K358CGM *s = S32K358_CGM(opaque);
+
+    switch (offset) {
+    case A_PLLCR:
+        return s->pllcr;
+    case A_PLLSR:
+        // The PLL locks as soon as it is powered up with a running reference
+        return s32k358_cgm_pll_locked(s) ? R_PLLSR_LOCK_MASK : 0;
+    case A_PLLDV:
+        return s->plldv;
+    case A_PLLFD:
+        return s->pllfd;
+    case A_PLLODIV_0:
+    case A_PLLODIV_1:
+        return s->pllodiv[(offset - A_PLLODIV_0) / 4];
+    default:
+        qemu_log_mask(LOG_UNIMP,
+                      "S32K358 PLL read: unimplemented offset 0x%x\n", (int)offset);
+        return 0;
+    }
+}
+
+static void s32k358_pll_write(void *opaque, hwaddr offset, uint64_t value,
+                              unsigned size)
+{
+    S32K358CGM *s = S32K358_CGM(opaque);
+
+    switch (offset) {
+    case A_PLLCR:
+        s->pllcr = value & R_PLLCR_PLLPD_MASK;
+        break;
+    case A_PLLSR:
+        // Loss of lock is never reported
+        return;
+    case A_PLLDV:
+        s->plldv = value;
+        break;
+    case A_PLLFD:
+        s->pllfd = value;
+        break;
+    case A_PLLODIV_0:
+    case A_PLLODIV_1:
+        s->pllodiv[(offset - A_PLLODIV_0) / 4] = value & (R_PLLODIV_DE_MASK | R_PLLODIV_DIV_MASK);
+        break;
+    default:
+        qemu_log_mask(LOG_UNIMP,
+                      "S32K358 PLL write: unimplemented offset 0x%x\n", (int)offset);
+        return;
+    }
+    s32k358_cgm_update(s, true);
+}
+
+static const MemoryRegionOps s32k358_pll_ops = {
+    .read = s32k358_pll_read,
+    .write = s32k358_pll_write,
+    .endianness = DEVICE_NATIVE_ENDIAN,
+    .valid.min_access_size = 4,
+    .valid.max_access_size = 4,
+};
+
+static void s32k358_cgm_reset(DeviceState *dev)
+{
+    S32K358CGM *s = S32K358_CGM(dev);
+
+    // After reset every clock runs from FIRC, with the dividers set to 1
+    s->fxosc_ctrl = 0;
+    s->pllcr = R_PLLCR_PLLPD_MASK;
+    s->plldv = 0;
+    s->pllfd = 0;
+    s->pllodiv[0] = 0;
+    s->pllodiv[1] = 0;
+    s->mux0_csc = 0;
+    s->mux0_css = 0;
+    for (int i = 0; i < S32K358_CGM_MUX0_DIVS; i++)
+        s->mux0_dc[i] = R_MUX_0_DC_DE_MASK;
+    s->mux0_div_trig_ctrl = 0;
+    s32k358_cgm_update(s, true);
+}
+
+static void s32k358_cgm_init(Object *obj)
+{
+    S32K358CGM *s = S32K358_CGM(obj);
+    SysBusDevice *sbd = SYS_BUS_DEVICE(obj);
+
+    memory_region_init_io(&s->fxosc_iomem, obj, &s32k358_fxosc_ops, s,
+                          "s32k358-fxosc", 0x8);
+    sysbus_init_mmio(sbd, &s->fxosc_iomem);
+    memory_region_init_io(&s->cgm_iomem, obj, &s32k358_mc_cgm_ops, s,
+                          "s32k358-mc-cgm", 0x4000);
+    sysbus_init_mmio(sbd, &s->cgm_iomem);
+    memory_region_init_io(&s->pll_iomem, obj, &s32k358_pll_ops, s,
+                          "s32k358-pll", 0x88);
+    sysbus_init_mmio(sbd, &s->pll_iomem);
+
+    s->core_clk = qdev_init_clock_out(DEVICE(obj), "core_clk");
+    s->aips_plat_clk = qdev_init_clock_out(DEVICE(obj), "aips_plat_clk");
+    s->aips_slow_clk = qdev_init_clock_out(DEVICE(obj), "aips_slow_clk");
+    // The consumers connected before the first reset see the reset frequency
+    clock_set_hz(s->core_clk, S32K358_FIRC_FRQ);
+    clock_set_hz(s->aips_plat_clk, S32K358_FIRC_FRQ);
+    clock_set_hz(s->aips_slow_clk, S32K358_FIRC_FRQ);
+}
+
+static void s32k358_cgm_realize(DeviceState *dev, Error **errp)
+{
+    S32K358CGM *s = S32K358_CGM(dev);
+
+    if (s->fxosc_frq == 0) {
+        error_setg(errp, "S32K358 CGM: fxosc-frq property must be set");
+        return;
+    }
+}
+
+// The consumers save their input clocks: only the outputs are recomputed
+static int s32k358_cgm_post_load(void *opaque, int version_id)
+{
+    s32k358_cgm_update(S32K358_CGM(opaque), false);
+    return 0;
+}
+
+static const VMStateDescription s32k358_cgm_vmstate = {
+    .name = "s32k358-cgm",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .post_load = s32k358_cgm_post_load,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT32(fxosc_ctrl, S32K358CGM),
+        VMSTATE_UINT32(pllcr, S32K358CGM),
+        VMSTATE_UINT32(plldv, S32K358CGM),
+        VMSTATE_UINT32(pllfd, S32K358CGM),
+        VMSTATE_UINT32_ARRAY(pllodiv, S32K358CGM, 2),
+        VMSTATE_UINT32(mux0_csc, S32K358CGM),
+        VMSTATE_UINT32(mux0_css, S32K358CGM),
+        VMSTATE_UINT32_ARRAY(mux0_dc, S32K358CGM, S32K358_CGM_MUX0_DIVS),
+        VMSTATE_UINT32(mux0_div_trig_ctrl, S32K358CGM),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static Property s32k358_cgm_properties[] = {
+    DEFINE_PROP_UINT32("fxosc-frq", S32K358CGM, fxosc_frq, 0),
+    DEFINE_PROP_END_OF_LIST(),
+};
+
+static void s32k358_cgm_class_init(ObjectClass *klass, void *data)
+{
+    DeviceClass *dc = DEVICE_CLASS(klass);
+
+    dc->realize = s32k358_cgm_realize;
+    dc->vmsd = &s32k358_cgm_vmstate;
+    dc->reset = s32k358_cgm_reset;
+    device_class_set_props(dc, s32k358_cgm_properties);
+}
+
+static const TypeInfo s32k358_cgm_info = {
+    .name = TYPE_S32K358_CGM,
+    .parent = TYPE_SYS_BUS_DEVICE,
+    .instance_size = sizeof(S32K358CGM),
+    .instance_init = s32k358_cgm_init,
+    .class_init = s32k358_cgm_class_init,
+};
+
+static void s32k358_cgm_register_types(void)
+{
+    type_register_static(&s32k358_cgm_info);
+}
+
+type_init(s32k358_cgm_register_types);
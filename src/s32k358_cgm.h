@@ -0,0 +1,61 @@
+/*
+ * S32K358 clock generation (FXOSC, PLL and MC_CGM) emulation
+ *
+ * SPDX-License-Identifier: CC-BY-NC-4.0
+ * Copyright (c) 2025 Braidotti Sara, Iorio Chiara, Pani Matteo.
+ *
+ */
+
+#ifndef S32K358_CGM_H
+#define S32K358_CGM_H
+
+#include "hw/sysbus.h"
+#include "hw/clock.h"
+#include "qom/object.h"
+
+#define TYPE_S32K358_CGM "s32k358-cgm"
+OBJECT_DECLARE_SIMPLE_TYPE(S32K358CGM, S32K358_CGM)
+
+/*
+ * QEMU interface:
+ *  + QOM property "fxosc-frq": frequency of the external crystal (FXOSC)
+ *  + sysbus MMIO region 0: FXOSC registers
+ *  + sysbus MMIO region 1: MC_CGM_0 registers (clock source multiplexer 0)
+ *  + sysbus MMIO region 2: PLL registers
+ *  + Clock output "core_clk": clock of the cores (MUX_0 divider 0)
+ *  + Clock output "aips_plat_clk": peripheral clock of the platform (MUX_0 divider 1)
+ *  + Clock output "aips_slow_clk": slow peripheral clock (MUX_0 divider 2)
+ */
+
+// Fast internal RC oscillator, as divided after reset
+#define S32K358_FIRC_FRQ        24000000
+#define S32K358_CGM_MUX0_DIVS   7
+
+struct S32K358CGM {
+    /*< private >*/
+    SysBusDevice parent_obj;
+
+    /*< public >*/
+    MemoryRegion fxosc_iomem;
+    MemoryRegion cgm_iomem;
+    MemoryRegion pll_iomem;
+    Clock *core_clk;
+    Clock *aips_plat_clk;
+    Clock *aips_slow_clk;
+
+    uint32_t fxosc_frq;
+    // FXOSC
+    uint32_t fxosc_ctrl;
+    // PLL
+    uint32_t pllcr;
+    uint32_t plldv;
+    uint32_t pllfd;
+    uint32_t pllodiv[2];
+    // MC_CGM_0 clock source multiplexer 0
+    uint32_t mux0_csc;
+    uint32_t mux0_css;
+    uint32_t mux0_dc[S32K358_CGM_MUX0_DIVS];
+    uint32_t mux0_div_trig_ctrl;
+};
+
+#endif
@@ -0,0 +1,773 @@
+/*
+ * S32K358 eDMA and DMAMUX emulation
+ *
+ * SPDX-License-Identifier: CC-BY-NC-4.0
+ * Copyright (c) 2025 Braidotti Sara, Iorio Chiara, Pani Matteo.
+ *
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/log.h"
+#include "qemu/main-loop.h"
+#include "qemu/module.h"
+#include "qemu/bswap.h"
+#include "qapi/error.h"
+#include "hw/sysbus.h"
+#include "hw/irq.h"
+#include "hw/qdev-properties.h"
+#include "hw/registerfields.h"
+#include "hw/arm/s32k358_edma.h"
+#include "exec/address-spaces.h"
+#include "migration/vmstate.h"
+
+// eDMA management page registers: chapter "eDMA" of the reference manual
+REG32(CSR, 0x0)
+    FIELD(CSR, EDBG, 1, 1) // enable debug
+    FIELD(CSR, ERCA, 2, 1) // enable round robin channel arbitration
+    FIELD(CSR, HAE, 4, 1) // halt after error
+    FIELD(CSR, HALT, 5, 1) // halt DMA operations
+    FIELD(CSR, GCLC, 6, 1) // global channel linking control
+    FIELD(CSR, GMRC, 7, 1) // global master ID replication control
+    FIELD(CSR, ECX, 8, 1) // cancel transfer with error
+    FIELD(CSR, CX, 9, 1) // cancel transfer
+    FIELD(CSR, ACTIVE_ID, 24, 5) // active channel ID
+    FIELD(CSR, ACTIVE, 31, 1) // DMA active
+REG32(ES, 0x4) // error status
+    FIELD(ES, ERRCHN, 24, 5) // error channel number
+    FIELD(ES, VLD, 31, 1) // logical OR of all the channel errors
+REG32(INT, 0x8) // interrupt request status of each channel
+REG32(HRS, 0xC) // hardware request status of each channel
+REG32(CH_GRPRI0, 0x100) // channel arbitration group, one register per channel
+    FIELD(CH_GRPRI0, GRPRI, 0, 5)
+
+// Channel page registers: one 0x4000 bytes page per channel
+REG32(CH_CSR, 0x0)
+    FIELD(CH_CSR, ERQ, 0, 1) // enable hardware request
+    FIELD(CH_CSR, EARQ, 1, 1) // enable asynchronous request
+    FIELD(CH_CSR, EEI, 2, 1) // enable error interrupt
+    FIELD(CH_CSR, EBW, 3, 1) // enable buffered writes
+    FIELD(CH_CSR, DONE, 30, 1) // channel done
+    FIELD(CH_CSR, ACTIVE, 31, 1) // channel active
+REG32(CH_ES, 0x4)
+    FIELD(CH_ES, DBE, 0, 1) // destination bus error
+    FIELD(CH_ES, SBE, 1, 1) // source bus error
+    FIELD(CH_ES, SGE, 2, 1) // scatter/gather configuration error
+    FIELD(CH_ES, NCE, 3, 1) // NBYTES/CITER configuration error
+    FIELD(CH_ES, DOE, 4, 1) // destination offset error
+    FIELD(CH_ES, DAE, 5, 1) // destination address error
+    FIELD(CH_ES, SOE, 6, 1) // source offset error
+    FIELD(CH_ES, SAE, 7, 1) // source address error
+    FIELD(CH_ES, ERR, 31, 1) // error in channel (w1c)
+REG32(CH_INT, 0x8)
+    FIELD(CH_INT, INT, 0, 1) // interrupt request (w1c)
+REG32(CH_SBR, 0xC) // system bus
+REG32(CH_PRI, 0x10) // channel priority
+
+// Transfer control descriptor
+REG32(TCD_SADDR, 0x20) // source address
+REG16(TCD_SOFF, 0x24) // signed source address offset
+REG16(TCD_ATTR, 0x26) // transfer attributes
+    FIELD(TCD_ATTR, DSIZE, 0, 3) // destination data transfer size
+    FIELD(TCD_ATTR, DMOD, 3, 5) // destination address modulo
+    FIELD(TCD_ATTR, SSIZE, 8, 3) // source data transfer size
+    FIELD(TCD_ATTR, SMOD, 11, 5) // source address modulo
+REG32(TCD_NBYTES, 0x28) // minor loop byte count
+    FIELD(TCD_NBYTES, NBYTES, 0, 30) // minor loop offsets disabled
+    FIELD(TCD_NBYTES, NBYTES_MLOFF, 0, 10) // minor loop offsets enabled
+    FIELD(TCD_NBYTES, MLOFF, 10, 20) // signed minor loop offset
+    FIELD(TCD_NBYTES, DMLOE, 30, 1) // destination minor loop offset enable
+    FIELD(TCD_NBYTES, SMLOE, 31, 1) // source minor loop offset enable
+REG32(TCD_SLAST_SDA, 0x2C) // last source address adjustment
+REG32(TCD_DADDR, 0x30) // destination address
+REG16(TCD_DOFF, 0x34) // signed destination address offset
+REG16(TCD_CITER, 0x36) // current major iteration count
+    FIELD(TCD_CITER, CITER, 0, 15) // channel linking disabled
+    FIELD(TCD_CITER, CITER_LINKED, 0, 9) // channel linking enabled
+    FIELD(TCD_CITER, LINKCH, 9, 5) // minor loop link channel
+    FIELD(TCD_CITER, ELINK, 15, 1) // enable minor loop linking
+REG32(TCD_DLAST_SGA, 0x38) // last destination address adjustment / scatter gather address
+REG16(TCD_CSR, 0x3C)
+    FIELD(TCD_CSR, START, 0, 1) // channel start
+    FIELD(TCD_CSR, INTMAJOR, 1, 1) // interrupt at the end of the major loop
+    FIELD(TCD_CSR, INTHALF, 2, 1) // interrupt at half of the major loop
+    FIELD(TCD_CSR, DREQ, 3, 1) // disable hardware request at the end of the major loop
+    FIELD(TCD_CSR, ESG, 4, 1) // enable scatter/gather
+    FIELD(TCD_CSR, MAJORELINK, 5, 1) // enable link when the major loop is complete
+    FIELD(TCD_CSR, EEOP, 6, 1) // enable end-of-packet processing
+    FIELD(TCD_CSR, ESDA, 7, 1) // enable store destination address
+    FIELD(TCD_CSR, MAJORLINKCH, 8, 5) // major loop link channel
+    FIELD(TCD_CSR, BWC, 14, 2) // bandwidth control
+REG16(TCD_BITER, 0x3E) // beginning major iteration count (same layout as CITER)
+
+// DMAMUX channel configuration: one byte per channel
+REG8(CHCFG, 0x0)
+    FIELD(CHCFG, SOURCE, 0, 6) // request source slot (0 is disabled)
+    FIELD(CHCFG, TRIG, 6, 1) // periodic trigger through the PIT
+    FIELD(CHCFG, ENBL, 7, 1) // enable channel
+
+#define EDMA_MGMT_SIZE      (A_CH_GRPRI0 + 4 * S32K358_EDMA_NUM_CHANNELS)
+#define EDMA_TCD_PAGE_SIZE  (A_TCD_SADDR + S32K358_EDMA_TCD_SIZE)
+// Bytes moved at a time by a bulk copy inside a minor loop
+#define EDMA_CHUNK_SIZE     256
+
+static uint32_t edma_tcd_get(struct edma_channel *ch, hwaddr reg, unsigned size)
+{
+    return ldn_le_p(&ch->tcd[reg - A_TCD_SADDR], size);
+}
+
+static void edma_tcd_set(struct edma_channel *ch, hwaddr reg, unsigned size,
+                         uint32_t value)
+{
+    stn_le_p(&ch->tcd[reg - A_TCD_SADDR], size, value);
+}
+
+static void edma_update_irq(struct edma_channel *ch)
+{
+    bool level = (ch->intr & R_CH_INT_INT_MASK) ||
+                 ((ch->es & R_CH_ES_ERR_MASK) && (ch->csr & R_CH_CSR_EEI_MASK));
+
+    qemu_set_irq(ch->irq, level);
+}
+
+// A channel is requested by the peripheral routed to it by the DMAMUX
+static bool edma_hw_request(S32K358EDMA *s, int n)
+{
+    uint8_t cfg = s->chcfg[n / S32K358_DMAMUX_NUM_CHANNELS][n % S32K358_DMAMUX_NUM_CHANNELS];
+    uint32_t source = FIELD_EX8(cfg, CHCFG, SOURCE);
+
+    if (!(cfg & R_CHCFG_ENBL_MASK) || source == 0) {
+        return false;
+    }
+    return (s->req[n / S32K358_DMAMUX_NUM_CHANNELS] >> source) & 1;
+}
+
+static void edma_error(S32K358EDMA *s, struct edma_channel *ch, uint32_t err)
+{
+    ch->es |= err | R_CH_ES_ERR_MASK;
+    ch->csr &= ~R_CH_CSR_ACTIVE_MASK;
+    if (s->csr & R_CSR_HAE_MASK) {
+        s->csr |= R_CSR_HALT_MASK;
+    }
+    edma_update_irq(ch);
+}
+
+// Next address of a source/destination, honouring the address modulo
+static uint32_t edma_next_addr(uint32_t addr, int32_t off, uint32_t mod)
+{
+    uint32_t mask = mod ? (1u << mod) - 1 : UINT32_MAX;
+
+    return (addr & ~mask) | ((addr + off) & mask);
+}
+
+// Execute the minor loop of a channel, returns false on a bus or configuration error
+static bool edma_minor_loop(S32K358EDMA *s, struct edma_channel *ch)
+{
+    uint32_t attr = edma_tcd_get(ch, A_TCD_ATTR, 2);
+    uint32_t nbytes_reg = edma_tcd_get(ch, A_TCD_NBYTES, 4);
+    uint32_t saddr = edma_tcd_get(ch, A_TCD_SADDR, 4);
+    uint32_t daddr = edma_tcd_get(ch, A_TCD_DADDR, 4);
+    int32_t soff = (int16_t)edma_tcd_get(ch, A_TCD_SOFF, 2);
+    int32_t doff = (int16_t)edma_tcd_get(ch, A_TCD_DOFF, 2);
+    uint32_t smod = FIELD_EX32(attr, TCD_ATTR, SMOD);
+    uint32_t dmod = FIELD_EX32(attr, TCD_ATTR, DMOD);
+    uint32_t ssize_field = FIELD_EX32(attr, TCD_ATTR, SSIZE);
+    uint32_t dsize_field = FIELD_EX32(attr, TCD_ATTR, DSIZE);
+    uint32_t ssize, dsize, nbytes;
+    int32_t mloff = 0;
+    uint8_t buf[EDMA_CHUNK_SIZE];
+    MemTxResult res;
+
+    // Transfer sizes are 1, 2, 4, 8, 16 and 32 bytes
+    if (ssize_field > 5 || dsize_field > 5) {
+        edma_error(s, ch, R_CH_ES_SAE_MASK | R_CH_ES_DAE_MASK);
+        return false;
+    }
+    ssize = 1 << ssize_field;
+    dsize = 1 << dsize_field;
+
+    if (nbytes_reg & (R_TCD_NBYTES_SMLOE_MASK | R_TCD_NBYTES_DMLOE_MASK)) {
+        nbytes = FIELD_EX32(nbytes_reg, TCD_NBYTES, NBYTES_MLOFF);
+        mloff = sextract32(nbytes_reg, R_TCD_NBYTES_MLOFF_SHIFT,
+                           R_TCD_NBYTES_MLOFF_LENGTH);
+    } else {
+        nbytes = FIELD_EX32(nbytes_reg, TCD_NBYTES, NBYTES);
+    }
+    if (nbytes == 0 || nbytes % ssize || nbytes % dsize) {
+        edma_error(s, ch, R_CH_ES_NCE_MASK);
+        return false;
+    }
+    if (saddr % ssize || daddr % dsize) {
+        edma_error(s, ch, (saddr % ssize ? R_CH_ES_SAE_MASK : 0) |
+                          (daddr % dsize ? R_CH_ES_DAE_MASK : 0));
+        return false;
+    }
+    if (soff % (int32_t)ssize || doff % (int32_t)dsize) {
+        edma_error(s, ch, (soff % (int32_t)ssize ? R_CH_ES_SOE_MASK : 0) |
+                          (doff % (int32_t)dsize ? R_CH_ES_DOE_MASK : 0));
+        return false;
+    }
+
+    /*
+     * The minor loop is moved in chunks through a bounce buffer. When the
+     * address simply advances by the element size (memory buffers) the whole
+     * chunk is copied with a single access, otherwise (peripheral registers,
+     * modulo buffers) one access per element is performed.
+     */
+    for (uint32_t done = 0; done < nbytes; ) {
+        uint32_t chunk = MIN(nbytes - done, EDMA_CHUNK_SIZE);
+
+        if (soff == (int32_t)ssize && smod == 0) {
+            res = address_space_read(&s->dma_as, saddr, MEMTXATTRS_UNSPECIFIED,
+                                     buf, chunk);
+            saddr += chunk;
+        } else {
+            res = MEMTX_OK;
+            for (uint32_t i = 0; i < chunk; i += ssize) {
+                res |= address_space_read(&s->dma_as, saddr, MEMTXATTRS_UNSPECIFIED,
+                                          buf + i, ssize);
+                saddr = edma_next_addr(saddr, soff, smod);
+            }
+        }
+        if (res != MEMTX_OK) {
+            edma_error(s, ch, R_CH_ES_SBE_MASK);
+            return false;
+        }
+
+        if (doff == (int32_t)dsize && dmod == 0) {
+            res = address_space_write(&s->dma_as, daddr, MEMTXATTRS_UNSPECIFIED,
+                                      buf, chunk);
+            daddr += chunk;
+        } else {
+            res = MEMTX_OK;
+            for (uint32_t i = 0; i < chunk; i += dsize) {
+                res |= address_space_write(&s->dma_as, daddr, MEMTXATTRS_UNSPECIFIED,
+                                           buf + i, dsize);
+                daddr = edma_next_addr(daddr, doff, dmod);
+            }
+        }
+        if (res != MEMTX_OK) {
+            edma_error(s, ch, R_CH_ES_DBE_MASK);
+            return false;
+        }
+        done += chunk;
+    }
+
+    // Minor loop offsets are applied after the last element
+    if (nbytes_reg & R_TCD_NBYTES_SMLOE_MASK) {
+        saddr += mloff;
+    }
+    if (nbytes_reg & R_TCD_NBYTES_DMLOE_MASK) {
+        daddr += mloff;
+    }
+    edma_tcd_set(ch, A_TCD_SADDR, 4, saddr);
+    edma_tcd_set(ch, A_TCD_DADDR, 4, daddr);
+    return true;
+}
+
+static uint32_t edma_iter_count(uint32_t iter)
+{
+    if (iter & R_TCD_CITER_ELINK_MASK) {
+        return FIELD_EX32(iter, TCD_CITER, CITER_LINKED);
+    }
+    return FIELD_EX32(iter, TCD_CITER, CITER);
+}
+
+// Load the next TCD of a scatter/gather chain
+static bool edma_scatter_gather(S32K358EDMA *s, struct edma_channel *ch,
+                                uint32_t addr)
+{
+    // TCDs must be aligned to 32 bytes
+    if (addr % S32K358_EDMA_TCD_SIZE) {
+        edma_error(s, ch, R_CH_ES_SGE_MASK);
+        return false;
+    }
+    if (address_space_read(&s->dma_as, addr, MEMTXATTRS_UNSPECIFIED,
+                           ch->tcd, S32K358_EDMA_TCD_SIZE) != MEMTX_OK) {
+        edma_error(s, ch, R_CH_ES_SBE_MASK);
+        return false;
+    }
+    // A loaded TCD with START set is executed immediately
+    if (edma_tcd_get(ch, A_TCD_CSR, 2) & R_TCD_CSR_START_MASK) {
+        s->pending |= 1u << ch->id;
+    }
+    return true;
+}
+
+/*
+ * Serve one service request of a channel: execute its minor loop and update
+ * the major loop. Returns true when the major loop is over (or the channel
+ * stopped on an error).
+ */
+static bool edma_service(S32K358EDMA *s, struct edma_channel *ch)
+{
+    uint32_t tcsr = edma_tcd_get(ch, A_TCD_CSR, 2);
+    uint32_t citer_reg = edma_tcd_get(ch, A_TCD_CITER, 2);
+    uint32_t biter = edma_iter_count(edma_tcd_get(ch, A_TCD_BITER, 2));
+    uint32_t citer = edma_iter_count(citer_reg);
+
+    if (citer == 0) {
+        edma_error(s, ch, R_CH_ES_NCE_MASK);
+        return true;
+    }
+
+    ch->csr |= R_CH_CSR_ACTIVE_MASK;
+    ch->csr &= ~R_CH_CSR_DONE_MASK;
+    tcsr &= ~R_TCD_CSR_START_MASK;
+    edma_tcd_set(ch, A_TCD_CSR, 2, tcsr);
+
+    if (!edma_minor_loop(s, ch)) {
+        return true;
+    }
+    citer--;
+    ch->csr &= ~R_CH_CSR_ACTIVE_MASK;
+
+    if (citer != 0) {
+        if (citer_reg & R_TCD_CITER_ELINK_MASK) {
+            s->pending |= 1u << FIELD_EX32(citer_reg, TCD_CITER, LINKCH);
+            citer_reg = FIELD_DP32(citer_reg, TCD_CITER, CITER_LINKED, citer);
+        } else {
+            citer_reg = FIELD_DP32(citer_reg, TCD_CITER, CITER, citer);
+        }
+        edma_tcd_set(ch, A_TCD_CITER, 2, citer_reg);
+        if ((tcsr & R_TCD_CSR_INTHALF_MASK) && citer == biter / 2) {
+            ch->intr |= R_CH_INT_INT_MASK;
+            edma_update_irq(ch);
+        }
+        return false;
+    }
+
+    // Major loop completed
+    ch->csr |= R_CH_CSR_DONE_MASK;
+    if (tcsr & R_TCD_CSR_DREQ_MASK) {
+        ch->csr &= ~R_CH_CSR_ERQ_MASK;
+    }
+    if (tcsr & R_TCD_CSR_INTMAJOR_MASK) {
+        ch->intr |= R_CH_INT_INT_MASK;
+    }
+    if (tcsr & R_TCD_CSR_MAJORELINK_MASK) {
+        s->pending |= 1u << FIELD_EX32(tcsr, TCD_CSR, MAJORLINKCH);
+    }
+    edma_tcd_set(ch, A_TCD_SADDR, 4, edma_tcd_get(ch, A_TCD_SADDR, 4) +
+                 edma_tcd_get(ch, A_TCD_SLAST_SDA, 4));
+    if (tcsr & R_TCD_CSR_ESG_MASK) {
+        edma_scatter_gather(s, ch, edma_tcd_get(ch, A_TCD_DLAST_SGA, 4));
+    } else {
+        edma_tcd_set(ch, A_TCD_DADDR, 4, edma_tcd_get(ch, A_TCD_DADDR, 4) +
+                     edma_tcd_get(ch, A_TCD_DLAST_SGA, 4));
+        edma_tcd_set(ch, A_TCD_CITER, 2, edma_tcd_get(ch, A_TCD_BITER, 2));
+    }
+    edma_update_irq(ch);
+    return true;
+}
+
+/*
+ * Transfer engine: serve the software (START and link) requests and the
+ * hardware requests of the enabled channels, lowest channel first.
+ */
+static void s32k358_edma_run(S32K358EDMA *s)
+{
+    if (s->running) {
+        // Requests raised by the transfers themselves are handled by the loop below
+        return;
+    }
+    s->running = true;
+
+    do {
+        for (int n = 0; n < S32K358_EDMA_NUM_CHANNELS; n++) {
+            struct edma_channel *ch = &s->channels[n];
+            bool major_done = false;
+
+            if (s->csr & R_CSR_HALT_MASK) {
+                break;
+            }
+            if (s->pending & (1u << n)) {
+                s->pending &= ~(1u << n);
+                edma_service(s, ch);
+                continue;
+            }
+            // A peripheral keeps its request asserted until it is served
+            while (!major_done && (ch->csr & R_CH_CSR_ERQ_MASK) &&
+                   !(ch->es & R_CH_ES_ERR_MASK) && edma_hw_request(s, n)) {
+                major_done = edma_service(s, ch);
+            }
+            // Let the guest react to the completion before starting the next major loop
+            if (major_done && (ch->csr & R_CH_CSR_ERQ_MASK) && edma_hw_request(s, n)) {
+                qemu_bh_schedule(s->bh);
+            }
+        }
+    } while (s->pending && !(s->csr & R_CSR_HALT_MASK));
+
+    s->running = false;
+}
+
+static void s32k358_edma_bh(void *opaque)
+{
+    s32k358_edma_run(S32K358_EDMA(opaque));
+}
+
+// Hardware request line of a peripheral, routed through the DMAMUX
+static void s32k358_edma_request(void *opaque, int line, int level)
+{
+    S32K358EDMA *s = S32K358_EDMA(opaque);
+    int mux = line / S32K358_DMAMUX_NUM_SOURCES;
+    int source = line % S32K358_DMAMUX_NUM_SOURCES;
+
+    if (level) {
+        s->req[mux] |= 1ULL << source;
+        // The transfer is not run inside the MMIO access that raised the request
+        qemu_bh_schedule(s->bh);
+    } else {
+        s->req[mux] &= ~(1ULL << source);
+    }
+}
+
+static uint64_t s32k358_edma_read(void *opaque, hwaddr offset, unsigned size)
+{
+    S32K358EDMA *s = S32K358_EDMA(opaque);
+    uint64_t r = 0;
+
+    switch (offset) {
+    case A_CSR:
+        r = s->csr;
+        break;
+    case A_ES:
+        for (int n = 0; n < S32K358_EDMA_NUM_CHANNELS; n++) {
+            if (s->channels[n].es & R_CH_ES_ERR_MASK) {
+                // report the error of the lowest channel
+                r = (s->channels[n].es & ~R_CH_ES_ERR_MASK) | R_ES_VLD_MASK;
+                r = FIELD_DP32(r, ES, ERRCHN, n);
+                break;
+            }
+        }
+        break;
+    case A_INT:
+        for (int n = 0; n < S32K358_EDMA_NUM_CHANNELS; n++) {
+            r |= (uint64_t)(s->channels[n].intr & R_CH_INT_INT_MASK) << n;
+        }
+        break;
+    case A_HRS:
+        for (int n = 0; n < S32K358_EDMA_NUM_CHANNELS; n++) {
+            r |= (uint64_t)edma_hw_request(s, n) << n;
+        }
+        break;
+    case A_CH_GRPRI0 ... EDMA_MGMT_SIZE - 1:
+        r = s->grpri[(offset - A_CH_GRPRI0) / 4];
+        break;
+    default:
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "S32K358 eDMA read: bad offset 0x%x\n", (int)offset);
+        break;
+    }
+    return r;
+}
+
+static void s32k358_edma_write(void *opaque, hwaddr offset, uint64_t value,
+                               unsigned size)
+{
+    S32K358EDMA *s = S32K358_EDMA(opaque);
+
+    switch (offset) {
+    case A_CSR:
+        // Transfers complete atomically: the cancel requests have nothing to cancel
+        s->csr = value & (R_CSR_EDBG_MASK | R_CSR_ERCA_MASK | R_CSR_HAE_MASK |
+                          R_CSR_HALT_MASK | R_CSR_GCLC_MASK | R_CSR_GMRC_MASK);
+        if (!(s->csr & R_CSR_HALT_MASK)) {
+            qemu_bh_schedule(s->bh);
+        }
+        break;
+    case A_ES:
+    case A_INT:
+    case A_HRS:
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "S32K358 eDMA write: write to Read-Only offset 0x%x\n",
+                      (int)offset);
+        break;
+    case A_CH_GRPRI0 ... EDMA_MGMT_SIZE - 1:
+        s->grpri[(offset - A_CH_GRPRI0) / 4] = value & R_CH_GRPRI0_GRPRI_MASK;
+        break;
+    default:
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "S32K358 eDMA write: bad offset 0x%x\n", (int)offset);
+        break;
+    }
+}
+
+static const MemoryRegionOps s32k358_edma_ops = {
+    .read = s32k358_edma_read,
+    .write = s32k358_edma_write,
+    .endianness = DEVICE_NATIVE_ENDIAN,
+    .valid.min_access_size = 4,
+    .valid.max_access_size = 4,
+};
+
+static uint64_t s32k358_edma_tcd_read(void *opaque, hwaddr offset, unsigned size)
+{
+    struct edma_channel *ch = opaque;
+    uint64_t r = 0;
+
+    // The TCD accepts 8, 16 and 32 bits accesses
+    if (offset >= A_TCD_SADDR) {
+        return edma_tcd_get(ch, offset, size);
+    }
+    if (size != 4) {
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "S32K358 eDMA read: bad access size %u at offset 0x%x\n",
+                      size, (int)offset);
+        return 0;
+    }
+
+    switch (offset) {
+    case A_CH_CSR:
+        r = ch->csr;
+        break;
+    case A_CH_ES:
+        r = ch->es;
+        break;
+    case A_CH_INT:
+        r = ch->intr;
+        break;
+    case A_CH_SBR:
+        r = ch->sbr;
+        break;
+    case A_CH_PRI:
+        r = ch->pri;
+        break;
+    default:
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "S32K358 eDMA read: bad offset 0x%x\n", (int)offset);
+        break;
+    }
+    return r;
+}
+
+static void s32k358_edma_tcd_write(void *opaque, hwaddr offset, uint64_t value,
+                                   unsigned size)
+{
+    struct edma_channel *ch = opaque;
+    S32K358EDMA *s = ch->parent;
+
+    if (offset >= A_TCD_SADDR) {
+        edma_tcd_set(ch, offset, size, value);
+        // Software request: the channel starts as soon as START is written
+        if (offset <= A_TCD_CSR && offset + size > A_TCD_CSR &&
+            (edma_tcd_get(ch, A_TCD_CSR, 2) & R_TCD_CSR_START_MASK)) {
+            s->pending |= 1u << ch->id;
+            s32k358_edma_run(s);
+        }
+        return;
+    }
+    if (size != 4) {
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "S32K358 eDMA write: bad access size %u at offset 0x%x\n",
+                      size, (int)offset);
+        return;
+    }
+
+    switch (offset) {
+    case A_CH_CSR:
+        ch->csr = (ch->csr & (R_CH_CSR_DONE_MASK | R_CH_CSR_ACTIVE_MASK)) |
+                  (value & (R_CH_CSR_ERQ_MASK | R_CH_CSR_EARQ_MASK |
+                            R_CH_CSR_EEI_MASK | R_CH_CSR_EBW_MASK));
+        if (value & R_CH_CSR_DONE_MASK) {
+            ch->csr &= ~R_CH_CSR_DONE_MASK;
+        }
+        edma_update_irq(ch);
+        // A request may already be pending when the channel is enabled
+        if ((ch->csr & R_CH_CSR_ERQ_MASK) && edma_hw_request(s, ch->id)) {
+            qemu_bh_schedule(s->bh);
+        }
+        break;
+    case A_CH_ES:
+        if (value & R_CH_ES_ERR_MASK) {
+            ch->es = 0;
+            edma_update_irq(ch);
+        }
+        break;
+    case A_CH_INT:
+        if (value & R_CH_INT_INT_MASK) {
+            ch->intr = 0;
+            edma_update_irq(ch);
+        }
+        break;
+    case A_CH_SBR:
+        ch->sbr = value;
+        break;
+    case A_CH_PRI:
+        ch->pri = value;
+        break;
+    default:
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "S32K358 eDMA write: bad offset 0x%x\n", (int)offset);
+        break;
+    }
+}
+
+static const MemoryRegionOps s32k358_edma_tcd_ops = {
+    .read = s32k358_edma_tcd_read,
+    .write = s32k358_edma_tcd_write,
+    .endianness = DEVICE_NATIVE_ENDIAN,
+    .valid.min_access_size = 1,
+    .valid.max_access_size = 4,
+};
+
+// The CHCFG registers are reversed inside each word: CHCFG0 is at offset 3
+static int dmamux_channel(hwaddr offset)
+{
+    return (offset & ~3) + (3 - (offset & 3));
+}
+
+static uint64_t s32k358_dmamux_read(void *opaque, hwaddr offset, unsigned size)
+{
+    uint8_t *chcfg = opaque;
+
+    return chcfg[dmamux_channel(offset)];
+}
+
+static void s32k358_dmamux_write(void *opaque, hwaddr offset, uint64_t value,
+                                 unsigned size)
+{
+    uint8_t *chcfg = opaque;
+
+    if (value & R_CHCFG_TRIG_MASK) {
+        qemu_log_mask(LOG_UNIMP, "S32K358 DMAMUX: periodic trigger not implemented\n");
+    }
+    chcfg[dmamux_channel(offset)] = value;
+}
+
+static const MemoryRegionOps s32k358_dmamux_ops = {
+    .read = s32k358_dmamux_read,
+    .write = s32k358_dmamux_write,
+    .endianness = DEVICE_NATIVE_ENDIAN,
+    .valid.min_access_size = 1,
+    .valid.max_access_size = 4,
+    .impl.min_access_size = 1,
+    .impl.max_access_size = 1,
+};
+
+static void s32k358_edma_reset(DeviceState *dev)
+{
+    S32K358EDMA *s = S32K358_EDMA(dev);
+
+    s->csr = 0;
+    s->pending = 0;
+    memset(s->grpri, 0, sizeof(s->grpri));
+    memset(s->chcfg, 0, sizeof(s->chcfg));
+    for (int n = 0; n < S32K358_EDMA_NUM_CHANNELS; n++) {
+        struct edma_channel *ch = &s->channels[n];
+
+        ch->csr = 0;
+        ch->es = 0;
+        ch->intr = 0;
+        ch->sbr = 0;
+        ch->pri = 0;
+        memset(ch->tcd, 0, sizeof(ch->tcd));
+        qemu_irq_lower(ch->irq);
+    }
+}
+
+static void s32k358_edma_init(Object *obj)
+{
+    S32K358EDMA *s = S32K358_EDMA(obj);
+    SysBusDevice *sbd = SYS_BUS_DEVICE(obj);
+
+    memory_region_init_io(&s->iomem, obj, &s32k358_edma_ops, s,
+                          TYPE_S32K358_EDMA, EDMA_MGMT_SIZE);
+    sysbus_init_mmio(sbd, &s->iomem);
+
+    for (int n = 0; n < S32K358_EDMA_NUM_CHANNELS; n++) {
+        struct edma_channel *ch = &s->channels[n];
+
+        ch->parent = s;
+        ch->id = n;
+        memory_region_init_io(&ch->iomem, obj, &s32k358_edma_tcd_ops, ch,
+                              "s32k358-edma-tcd", EDMA_TCD_PAGE_SIZE);
+        sysbus_init_mmio(sbd, &ch->iomem);
+    }
+    for (int i = 0; i < S32K358_DMAMUX_NUM; i++) {
+        memory_region_init_io(&s->mux_iomem[i], obj, &s32k358_dmamux_ops,
+                              s->chcfg[i], "s32k358-dmamux",
+                              S32K358_DMAMUX_NUM_CHANNELS);
+        sysbus_init_mmio(sbd, &s->mux_iomem[i]);
+    }
+    // Connect the irq lines, the IRQs must be initialized after the MMIO regions
+    for (int n = 0; n < S32K358_EDMA_NUM_CHANNELS; n++) {
+        sysbus_init_irq(sbd, &s->channels[n].irq);
+    }
+    qdev_init_gpio_in_named(DEVICE(obj), s32k358_edma_request, "dma-req",
+                            S32K358_DMAMUX_NUM * S32K358_DMAMUX_NUM_SOURCES);
+}
+
+static void s32k358_edma_realize(DeviceState *dev, Error **errp)
+{
+    S32K358EDMA *s = S32K358_EDMA(dev);
+
+    if (!s->dma_mr) {
+        error_setg(errp, "S32K358 eDMA: memory property must be set");
+        return;
+    }
+    address_space_init(&s->dma_as, s->dma_mr, "s32k358-edma");
+    s->bh = qemu_bh_new_guarded(s32k358_edma_bh, s, &dev->mem_reentrancy_guard);
+}
+
+static Property s32k358_edma_properties[] = {
+    DEFINE_PROP_LINK("memory", S32K358EDMA, dma_mr, TYPE_MEMORY_REGION,
+                     MemoryRegion *),
+    DEFINE_PROP_END_OF_LIST(),
+};
+
+static const VMStateDescription s32k358_edma_channel_vmstate = {
+    .name = "s32k358-edma-channel",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT32(csr, struct edma_channel),
+        VMSTATE_UINT32(es, struct edma_channel),
+        VMSTATE_UINT32(intr, struct edma_channel),
+        VMSTATE_UINT32(sbr, struct edma_channel),
+        VMSTATE_UINT32(pri, struct edma_channel),
+        VMSTATE_UINT8_ARRAY(tcd, struct edma_channel, S32K358_EDMA_TCD_SIZE),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static const VMStateDescription s32k358_edma_vmstate = {
+    .name = "s32k358-edma",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT32(csr, S32K358EDMA),
+        VMSTATE_UINT32_ARRAY(grpri, S32K358EDMA, S32K358_EDMA_NUM_CHANNELS),
+        VMSTATE_STRUCT_ARRAY(channels, S32K358EDMA, S32K358_EDMA_NUM_CHANNELS,
+                             1, s32k358_edma_channel_vmstate, struct edma_channel),
+        VMSTATE_UINT8_2DARRAY(chcfg, S32K358EDMA, S32K358_DMAMUX_NUM,
+                              S32K358_DMAMUX_NUM_CHANNELS),
+        VMSTATE_UINT64_ARRAY(req, S32K358EDMA, S32K358_DMAMUX_NUM),
+        VMSTATE_UINT32(pending, S32K358EDMA),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static void s32k358_edma_class_init(ObjectClass *klass, void *data)
+{
+    DeviceClass *dc = DEVICE_CLASS(klass);
+
+    dc->realize = s32k358_edma_realize;
+    dc->vmsd = &s32k358_edma_vmstate;
+    dc->reset = s32k358_edma_reset;
+    device_class_set_props(dc, s32k358_edma_properties);
+}
+
+static const TypeInfo s32k358_edma_info = {
+    .name = TYPE_S32K358_EDMA,
+    .parent = TYPE_SYS_BUS_DEVICE,
+    .instance_size = sizeof(S32K358EDMA),
+    .instance_init = s32k358_edma_init,
+    .class_init = s32k358_edma_class_init,
+};
+
+static void s32k358_edma_register_types(void)
+{
+    type_register_static(&s32k358_edma_info);
+}
+
+type_init(s32k358_edma_register_types);
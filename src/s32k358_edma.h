@@ -0,0 +1,88 @@
+/*
+ * S32K358 eDMA and DMAMUX emulation
+ *
+ * SPDX-License-Identifier: CC-BY-NC-4.0
+ * Copyright (c) 2025 Braidotti Sara, Iorio Chiara, Pani Matteo.
+ *
+ */
+
+#ifndef S32K358_EDMA_H
+#define S32K358_EDMA_H
+
+#include "hw/sysbus.h"
+#include "exec/memory.h"
+#include "qom/object.h"
+
+#define TYPE_S32K358_EDMA "s32k358-edma"
+OBJECT_DECLARE_SIMPLE_TYPE(S32K358EDMA, S32K358_EDMA)
+
+/*
+ * QEMU interface:
+ *  + QOM property "memory": the memory region the eDMA reads and writes
+ *  + sysbus MMIO region 0: the management page (CSR, ES, INT, HRS, CH_GRPRI)
+ *  + sysbus MMIO regions 1..32: the TCD page of each channel
+ *  + sysbus MMIO regions 33 and 34: DMAMUX_0 and DMAMUX_1
+ *  + sysbus IRQ n: transfer complete/error interrupt of channel n
+ *  + named GPIO inputs "dma-req": hardware request sources, numbered
+ *    mux * S32K358_DMAMUX_NUM_SOURCES + source
+ */
+
+#define S32K358_EDMA_NUM_CHANNELS      32
+#define S32K358_DMAMUX_NUM             2
+// Each DMAMUX routes its sources to 16 eDMA channels
+#define S32K358_DMAMUX_NUM_CHANNELS    16
+#define S32K358_DMAMUX_NUM_SOURCES     64
+// Size of the transfer control descriptor (TCD_SADDR ... TCD_BITER)
+#define S32K358_EDMA_TCD_SIZE          0x20
+
+#define S32K358_EDMA_MMIO_MGMT         0
+#define S32K358_EDMA_MMIO_TCD(n)       (1 + (n))
+#define S32K358_EDMA_MMIO_DMAMUX(n)    (1 + S32K358_EDMA_NUM_CHANNELS + (n))
+
+// Hardware request sources of the LPUARTs: LPUART0..7 on DMAMUX_0, LPUART8..15 on DMAMUX_1
+#define S32K358_DMAMUX_LPUART_RX_SOURCE(n)   (((n) / 8) * S32K358_DMAMUX_NUM_SOURCES + 36 + 2 * ((n) % 8))
+#define S32K358_DMAMUX_LPUART_TX_SOURCE(n)   (S32K358_DMAMUX_LPUART_RX_SOURCE(n) + 1)
+
+struct S32K358EDMA;
+
+// Data structure representing each eDMA channel
+struct edma_channel {
+    struct S32K358EDMA *parent;
+    uint32_t id;
+    qemu_irq irq;
+    MemoryRegion iomem; // TCD page of the channel
+    uint32_t csr;
+    uint32_t es;
+    uint32_t intr;
+    uint32_t sbr;
+    uint32_t pri;
+    // Transfer control descriptor, stored with the guest (little endian) layout
+    uint8_t tcd[S32K358_EDMA_TCD_SIZE];
+};
+
+struct S32K358EDMA {
+    /*< private >*/
+    SysBusDevice parent_obj;
+
+    /*< public >*/
+    MemoryRegion iomem; // management page
+    MemoryRegion mux_iomem[S32K358_DMAMUX_NUM];
+    MemoryRegion *dma_mr;
+    AddressSpace dma_as;
+    QEMUBH *bh;
+
+    uint32_t csr;
+    uint32_t grpri[S32K358_EDMA_NUM_CHANNELS];
+    struct edma_channel channels[S32K358_EDMA_NUM_CHANNELS];
+
+    // DMAMUX channel configuration registers
+    uint8_t chcfg[S32K358_DMAMUX_NUM][S32K358_DMAMUX_NUM_CHANNELS];
+    // Level of the hardware request sources
+    uint64_t req[S32K358_DMAMUX_NUM];
+    // Channels with a software (START or link) request pending
+    uint32_t pending;
+    // The transfer engine is running: requests are only recorded
+    bool running;
+};
+
+#endif
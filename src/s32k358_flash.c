@@ -0,0 +1,442 @@
+/*
+ * S32K358 data flash and C40 program/erase controller emulation
+ *
+ * SPDX-License-Identifier: CC-BY-NC-4.0
+ * Copyright (c) 2025 Braidotti Sara, Iorio Chiara, Pani Matteo.
+ *
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/log.h"
+#include "qemu/module.h"
+#include "qemu/bswap.h"
+#include "qapi/error.h"
+#include "hw/sysbus.h"
+#include "hw/irq.h"
+#include "hw/qdev-properties.h"
+#include "hw/registerfields.h"
+#include "hw/arm/s32k358_flash.h"
+#include "sysemu/hostmem.h"
+#include "migration/vmstate.h"
+
+// PFC registers: only the program/erase address and the locks of the data flash block
+REG32(PFCPGM_PEADR_L, 0x300)
+REG32(PFCBLK4_SPELOCK, 0x350) // one bit per 8 KB sector of the data flash
+
+// FMU registers
+REG32(MCR, 0x0) // module configuration
+    FIELD(MCR, EHV, 0, 1) // enable high voltage: starts the operation
+    FIELD(MCR, ERS, 4, 1) // erase
+    FIELD(MCR, ESS, 5, 1) // erase size select (0 sector, 1 block)
+    FIELD(MCR, PGM, 8, 1) // program
+    FIELD(MCR, WDIE, 15, 1) // watchdog interrupt enable
+    FIELD(MCR, PECIE, 16, 1) // program/erase complete interrupt enable
+    FIELD(MCR, PEID, 24, 8) // program/erase master ID
+REG32(MCRS, 0x4) // module configuration status
+    FIELD(MCRS, RE, 0, 1) // reset error
+    FIELD(MCRS, TSPELOCK, 8, 1) // target sector locked
+    FIELD(MCRS, EPEG, 9, 1) // ECC enabled program/erase good
+    FIELD(MCRS, WDI, 12, 1) // watchdog interrupt
+    FIELD(MCRS, PEG, 14, 1) // program/erase good
+    FIELD(MCRS, DONE, 15, 1) // state machine status
+    FIELD(MCRS, PES, 16, 1) // program/erase sequence error (w1c)
+    FIELD(MCRS, PEP, 17, 1) // program/erase protection error (w1c)
+REG32(MCRE, 0x8) // module configuration extension
+REG32(ADR, 0x10) // address of the last failed operation
+REG32(PEADR, 0x14) // program/erase address (read-only copy of PFCPGM_PEADR_L)
+REG32(DATA0, 0x100) // program data
+REG32(DATA31, 0x17C)
+
+#define DFLASH_SECTORS      (S32K358_DFLASH_SIZE / S32K358_DFLASH_SECTOR_SIZE)
+#define DFLASH_QUAD_PAGE    (S32K358_FMU_DATA_WORDS * 4)
+
+// Typical program and erase times of the datasheet (C40 flash)
+#define DFLASH_DWPGM_NS     38000 // double word (64 bits)
+#define DFLASH_PPGM_NS      73000 // page (256 bits)
+#define DFLASH_QPPGM_NS     268000 // quad-page (1024 bits)
+#define DFLASH_SECTOR_ERS_NS 6100000 // 8 KB sector
+
+static void s32k358_dflash_update_irq(S32K358DFlash *s)
+{
+    qemu_set_irq(s->irq, (s->mcr & R_MCR_PECIE_MASK) && (s->mcr & R_MCR_EHV_MASK) &&
+                         (s->mcrs & R_MCRS_DONE_MASK));
+}
+
+static bool s32k358_dflash_locked(S32K358DFlash *s, uint32_t offset, uint32_t len)
+{
+    for (uint32_t sector = offset / S32K358_DFLASH_SECTOR_SIZE;
+         sector <= (offset + len - 1) / S32K358_DFLASH_SECTOR_SIZE; sector++) {
+        if (s->spelock & (1u << sector)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Range of the array touched by the requested operation
+static void s32k358_dflash_range(S32K358DFlash *s, uint32_t *offset, uint32_t *len)
+{
+    uint32_t addr = s->peadr - S32K358_DFLASH_BASE;
+
+    if (s->mcr & R_MCR_PGM_MASK) {
+        int first = ctz32(s->data_written);
+        int last = 31 - clz32(s->data_written);
+
+        *offset = (addr & ~(DFLASH_QUAD_PAGE - 1)) + 4 * first;
+        *len = 4 * (last - first + 1);
+    } else if (s->mcr & R_MCR_ESS_MASK) {
+        *offset = 0;
+        *len = S32K358_DFLASH_SIZE;
+    } else {
+        *offset = addr & ~(S32K358_DFLASH_SECTOR_SIZE - 1);
+        *len = S32K358_DFLASH_SECTOR_SIZE;
+    }
+}
+
+// Perform the operation on the array when it completes
+static void s32k358_dflash_complete(S32K358DFlash *s)
+{
+    uint8_t *ptr = memory_region_get_ram_ptr(s->array);
+    uint32_t offset, len;
+
+    s32k358_dflash_range(s, &offset, &len);
+    if (s->mcr & R_MCR_PGM_MASK) {
+        uint32_t base = offset & ~(DFLASH_QUAD_PAGE - 1);
+
+        // Programming can only clear bits
+        for (int i = 0; i < S32K358_FMU_DATA_WORDS; i++) {
+            if (s->data_written & (1u << i)) {
+                stl_le_p(ptr + base + 4 * i, ldl_le_p(ptr + base + 4 * i) & s->data[i]);
+            }
+        }
+    } else {
+        memset(ptr + offset, 0xFF, len);
+    }
+    memory_region_set_dirty(s->array, offset, len);
+
+    s->mcrs |= R_MCRS_DONE_MASK | R_MCRS_PEG_MASK | R_MCRS_EPEG_MASK;
+    s32k358_dflash_update_irq(s);
+}
+
+static void s32k358_dflash_busy_cb(void *opaque)
+{
+    s32k358_dflash_complete(S32K358_DFLASH(opaque));
+}
+
+// The operation cannot be started: it ends immediately with PEG cleared
+static void s32k358_dflash_fail(S32K358DFlash *s, uint32_t error)
+{
+    s->mcrs |= R_MCRS_DONE_MASK | error;
+    s->mcrs &= ~(R_MCRS_PEG_MASK | R_MCRS_EPEG_MASK);
+    s->adr = s->peadr;
+    s32k358_dflash_update_irq(s);
+}
+
+// MCR[EHV] set: start the program or erase operation
+static void s32k358_dflash_start(S32K358DFlash *s)
+{
+    uint32_t offset, len;
+    int64_t busy_ns;
+
+    if (!(s->mcr & (R_MCR_PGM_MASK | R_MCR_ERS_MASK)) ||
+        s->peadr < S32K358_DFLASH_BASE ||
+        s->peadr >= S32K358_DFLASH_BASE + S32K358_DFLASH_SIZE ||
+        ((s->mcr & R_MCR_PGM_MASK) && !s->data_written)) {
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "S32K358 FMU: bad program/erase sequence (address 0x%x)\n", s->peadr);
+        s32k358_dflash_fail(s, R_MCRS_PES_MASK);
+        return;
+    }
+
+    s32k358_dflash_range(s, &offset, &len);
+    if (s32k358_dflash_locked(s, offset, len)) {
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "S32K358 FMU: program/erase of a locked sector (address 0x%x)\n", s->peadr);
+        s32k358_dflash_fail(s, R_MCRS_PEP_MASK | R_MCRS_TSPELOCK_MASK);
+        return;
+    }
+
+    s->mcrs &= ~(R_MCRS_DONE_MASK | R_MCRS_PEG_MASK | R_MCRS_EPEG_MASK | R_MCRS_TSPELOCK_MASK);
+    s32k358_dflash_update_irq(s);
+    if (!s->timing) {
+        s32k358_dflash_complete(s);
+        return;
+    }
+
+    if (s->mcr & R_MCR_ERS_MASK) {
+        busy_ns = (int64_t)DFLASH_SECTOR_ERS_NS * (len / S32K358_DFLASH_SECTOR_SIZE);
+    } else if (len <= 8 && (offset & ~7) == ((offset + len - 1) & ~7)) {
+        busy_ns = DFLASH_DWPGM_NS;
+    } else if ((offset & ~31) == ((offset + len - 1) & ~31)) {
+        busy_ns = DFLASH_PPGM_NS;
+    } else {
+        busy_ns = DFLASH_QPPGM_NS;
+    }
+    timer_mod(s->busy_timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + busy_ns);
+}
+
+static uint64_t s32k358_pfc_read(void *opaque, hwaddr offset, unsigned size)
+{
+    S32K358DFlash *s = S32K358_DFLASH(opaque);
+
+    switch (offset) {
+    case A_PFCPGM_PEADR_L:
+        return s->peadr;
+    case A_PFCBLK4_SPELOCK:
+        return s->spelock;
+    default:
+        qemu_log_mask(LOG_UNIMP,
+                      "S32K358 PFC read: unimplemented offset 0x%x\n", (int)offset);
+        return 0;
+    }
+}
+
+static void s32k358_pfc_write(void *opaque, hwaddr offset, uint64_t value,
+                              unsigned size)
+{
+    S32K358DFlash *s = S32K358_DFLASH(opaque);
+
+    switch (offset) {
+    case A_PFCPGM_PEADR_L:
+        // The address cannot change during an operation
+        if (s->mcr & R_MCR_EHV_MASK) {
+            qemu_log_mask(LOG_GUEST_ERROR,
+                          "S32K358 PFC: PEADR written while MCR[EHV] is set\n");
+            break;
+        }
+        s->peadr = value;
+        break;
+    case A_PFCBLK4_SPELOCK:
+        s->spelock = value & MAKE_64BIT_MASK(0, DFLASH_SECTORS);
+        break;
+    default:
+        qemu_log_mask(LOG_UNIMP,
+                      "S32K358 PFC write: unimplemented offset 0x%x\n", (int)offset);
+        break;
+    }
+}
+
+static const MemoryRegionOps s32k358_pfc_ops = {
+    .read = s32k358_pfc_read,
+    .write = s32k358_pfc_write,
+    .endianness = DEVICE_NATIVE_ENDIAN,
+    .valid.min_access_size = 4,
+    .valid.max_access_size = 4,
+};
+
+static uint64_t s32k358_fmu_read(void *opaque, hwaddr offset, unsigned size)
+{
+    S32K358DFlash *s = S32K358_DFLASH(opaque);
+
+    switch (offset) {
+    case A_MCR:
+        return s->mcr;
+    case A_MCRS:
+        return s->mcrs;
+    case A_MCRE:
+        return 0;
+    case A_ADR:
+        return s->adr;
+    case A_PEADR:
+        return s->peadr;
+    case A_DATA0 ... A_DATA31:
+        return s->data[(offset - A_DATA0) / 4];
+    default:
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "S32K358 FMU read: bad offset 0x%x\n", (int)offset);
+        return 0;
+    }
+}
+
+static void s32k358_fmu_write(void *opaque, hwaddr offset, uint64_t value,
+                              unsigned size)
+{
+    S32K358DFlash *s = S32K358_DFLASH(opaque);
+    uint32_t mode = R_MCR_PGM_MASK | R_MCR_ERS_MASK | R_MCR_ESS_MASK;
+
+    switch (offset) {
+    case A_MCR:
+        if (s->mcr & R_MCR_EHV_MASK) {
+            // Only EHV and the interrupt enables can change during an operation
+            if ((value ^ s->mcr) & mode) {
+                qemu_log_mask(LOG_GUEST_ERROR,
+                              "S32K358 FMU: PGM/ERS changed while MCR[EHV] is set\n");
+                value = (value & ~mode) | (s->mcr & mode);
+            }
+            s->mcr = value & (R_MCR_EHV_MASK | mode | R_MCR_WDIE_MASK | R_MCR_PECIE_MASK);
+            if (!(s->mcr & R_MCR_EHV_MASK) && !(s->mcrs & R_MCRS_DONE_MASK)) {
+                // Operation aborted
+                timer_del(s->busy_timer);
+                s32k358_dflash_fail(s, 0);
+            }
+            s32k358_dflash_update_irq(s);
+            break;
+        }
+        if ((value & R_MCR_PGM_MASK) && (value & R_MCR_ERS_MASK)) {
+            qemu_log_mask(LOG_GUEST_ERROR,
+                          "S32K358 FMU: PGM and ERS cannot be both set\n");
+            break;
+        }
+        // A new program sequence collects new data
+        if ((value & R_MCR_PGM_MASK) && !(s->mcr & R_MCR_PGM_MASK)) {
+            s->data_written = 0;
+        }
+        s->mcr = value & (R_MCR_EHV_MASK | mode | R_MCR_WDIE_MASK | R_MCR_PECIE_MASK);
+        if (s->mcr & R_MCR_EHV_MASK) {
+            s32k358_dflash_start(s);
+        }
+        s32k358_dflash_update_irq(s);
+        break;
+    case A_MCRS:
+        s->mcrs &= ~(value & (R_MCRS_PES_MASK | R_MCRS_PEP_MASK));
+        break;
+    case A_DATA0 ... A_DATA31:
+        if (!(s->mcr & R_MCR_PGM_MASK) || (s->mcr & R_MCR_EHV_MASK)) {
+            qemu_log_mask(LOG_GUEST_ERROR,
+                          "S32K358 FMU: DATA written outside a program sequence\n");
+            break;
+        }
+        s->data[(offset - A_DATA0) / 4] = value;
+        s->data_written |= 1u << ((offset - A_DATA0) / 4);
+        break;
+    case A_MCRE:
+    case A_ADR:
+    case A_PEADR:
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "S32K358 FMU write: write to Read-Only offset 0x%x\n", (int)offset);
+        break;
+    default:
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "S32K358 FMU write: bad offset 0x%x\n", (int)offset);
+        break;
+    }
+}
+
+static const MemoryRegionOps s32k358_fmu_ops = {
+    .read = s32k358_fmu_read,
+    .write = s32k358_fmu_write,
+    .endianness = DEVICE_NATIVE_ENDIAN,
+    .valid.min_access_size = 4,
+    .valid.max_access_size = 4,
+};
+
+static void s32k358_dflash_reset(DeviceState *dev)
+{
+    S32K358DFlash *s = S32K358_DFLASH(dev);
+
+    // The content of the array is kept across resets
+    timer_del(s->busy_timer);
+    s->mcr = 0;
+    s->mcrs = R_MCRS_DONE_MASK;
+    s->adr = 0;
+    s->peadr = 0;
+    s->spelock = MAKE_64BIT_MASK(0, DFLASH_SECTORS); // all the sectors are locked
+    s->data_written = 0;
+    memset(s->data, 0, sizeof(s->data));
+    qemu_irq_lower(s->irq);
+}
+
+static void s32k358_dflash_init(Object *obj)
+{
+    S32K358DFlash *s = S32K358_DFLASH(obj);
+    SysBusDevice *sbd = SYS_BUS_DEVICE(obj);
+
+    memory_region_init(&s->container, obj, "s32k358.dflash", S32K358_DFLASH_SIZE);
+    sysbus_init_mmio(sbd, &s->container);
+    memory_region_init_io(&s->pfc_iomem, obj, &s32k358_pfc_ops, s,
+                          "s32k358-pfc", 0x4000);
+    sysbus_init_mmio(sbd, &s->pfc_iomem);
+    memory_region_init_io(&s->fmu_iomem, obj, &s32k358_fmu_ops, s,
+                          "s32k358-fmu", 0x180);
+    sysbus_init_mmio(sbd, &s->fmu_iomem);
+    sysbus_init_irq(sbd, &s->irq);
+}
+
+static void s32k358_dflash_realize(DeviceState *dev, Error **errp)
+{
+    ERRP_GUARD();
+    S32K358DFlash *s = S32K358_DFLASH(dev);
+
+    if (s->memdev) {
+        s->array = host_memory_backend_get_memory(s->memdev);
+        if (host_memory_backend_is_mapped(s->memdev)) {
+            error_setg(errp, "S32K358 data flash: memory backend %s is already in use",
+                       object_get_canonical_path_component(OBJECT(s->memdev)));
+            return;
+        }
+        if (memory_region_size(s->array) != S32K358_DFLASH_SIZE) {
+            error_setg(errp, "S32K358 data flash: the memory backend must be 128 KB");
+            return;
+        }
+        // Program and erase write the backend directly, so it cannot be a read-only mapping
+        if (memory_region_is_rom(s->array)) {
+            error_setg(errp, "S32K358 data flash: memory backend %s is read-only",
+                       object_get_canonical_path_component(OBJECT(s->memdev)));
+            return;
+        }
+        host_memory_backend_set_mapped(s->memdev, true);
+    } else {
+        memory_region_init_rom(&s->flash, OBJECT(dev), "s32k358.dflash.array",
+                               S32K358_DFLASH_SIZE, errp);
+        if (*errp) {
+            return;
+        }
+        s->array = &s->flash;
+        // Erased flash
+        memset(memory_region_get_ram_ptr(s->array), 0xFF, S32K358_DFLASH_SIZE);
+    }
+    // The guest writes the array only through the FMU
+    memory_region_set_readonly(s->array, true);
+    memory_region_add_subregion(&s->container, 0, s->array);
+
+    s->busy_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, s32k358_dflash_busy_cb, s);
+}
+
+static Property s32k358_dflash_properties[] = {
+    DEFINE_PROP_LINK("memdev", S32K358DFlash, memdev, TYPE_MEMORY_BACKEND,
+                     HostMemoryBackend *),
+    DEFINE_PROP_BOOL("timing", S32K358DFlash, timing, true),
+    DEFINE_PROP_END_OF_LIST(),
+};
+
+static const VMStateDescription s32k358_dflash_vmstate = {
+    .name = "s32k358-dflash",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT32(mcr, S32K358DFlash),
+        VMSTATE_UINT32(mcrs, S32K358DFlash),
+        VMSTATE_UINT32(adr, S32K358DFlash),
+        VMSTATE_UINT32(peadr, S32K358DFlash),
+        VMSTATE_UINT32(spelock, S32K358DFlash),
+        VMSTATE_UINT32_ARRAY(data, S32K358DFlash, S32K358_FMU_DATA_WORDS),
+        VMSTATE_UINT32(data_written, S32K358DFlash),
+        VMSTATE_TIMER_PTR(busy_timer, S32K358DFlash),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static void s32k358_dflash_class_init(ObjectClass *klass, void *data)
+{
+    DeviceClass *dc = DEVICE_CLASS(klass);
+
+    dc->realize = s32k358_dflash_realize;
+    dc->vmsd = &s32k358_dflash_vmstate;
+    dc->reset = s32k358_dflash_reset;
+    device_class_set_props(dc, s32k358_dflash_properties);
+}
+
+static const TypeInfo s32k358_dflash_info = {
+    .name = TYPE_S32K358_DFLASH,
+    .parent = TYPE_SYS_BUS_DEVICE,
+    .instance_size = sizeof(S32K358DFlash),
+    .instance_init = s32k358_dflash_init,
+    .class_init = s32k358_dflash_class_init,
+};
+
+static void s32k358_dflash_register_types(void)
+{
+    type_register_static(&s32k358_dflash_info);
+}
+
+type_init(s32k358_dflash_register_types);
@@ -0,0 +1,62 @@
+/*
+ * S32K358 data flash and C40 program/erase controller emulation
+ *
+ * SPDX-License-Identifier: CC-BY-NC-4.0
+ * Copyright (c) 2025 Braidotti Sara, Iorio Chiara, Pani Matteo.
+ *
+ */
+
+#ifndef S32K358_FLASH_H
+#define S32K358_FLASH_H
+
+#include "hw/sysbus.h"
+#include "exec/memory.h"
+#include "qemu/timer.h"
+#include "sysemu/hostmem.h"
+#include "qom/object.h"
+
+#define TYPE_S32K358_DFLASH "s32k358-dflash"
+OBJECT_DECLARE_SIMPLE_TYPE(S32K358DFlash, S32K358_DFLASH)
+
+/*
+ * QEMU interface:
+ *  + QOM property "memdev": memory backend holding the data flash (e.g. a shared
+ *    memory-backend-file, so that the content persists), optional
+ *  + QOM property "timing": program and erase take the datasheet busy times
+ *  + sysbus MMIO region 0: the data flash array
+ *  + sysbus MMIO region 1: the PFC registers (program address and sector locks)
+ *  + sysbus MMIO region 2: the FMU registers (program/erase control and data)
+ *  + sysbus IRQ 0: program or erase operation completed
+ */
+
+#define S32K358_DFLASH_BASE         0x10000000
+#define S32K358_DFLASH_SIZE         0x20000
+#define S32K358_DFLASH_SECTOR_SIZE  0x2000
+// Program data registers: a quad-page of 128 bytes
+#define S32K358_FMU_DATA_WORDS      32
+
+struct S32K358DFlash {
+    /*< private >*/
+    SysBusDevice parent_obj;
+
+    /*< public >*/
+    MemoryRegion container; // data flash address range
+    MemoryRegion flash; // array used when there is no memory backend
+    MemoryRegion *array;
+    MemoryRegion pfc_iomem;
+    MemoryRegion fmu_iomem;
+    qemu_irq irq;
+    HostMemoryBackend *memdev;
+    bool timing;
+    QEMUTimer *busy_timer; // end of the running program/erase operation
+
+    uint32_t mcr;
+    uint32_t mcrs;
+    uint32_t adr;
+    uint32_t peadr; // program/erase address (PFCPGM_PEADR_L)
+    uint32_t spelock; // sector locks of the data flash block, 1 = locked
+    uint32_t data[S32K358_FMU_DATA_WORDS];
+    uint32_t data_written; // DATA registers written since the program sequence started
+};
+
+#endif
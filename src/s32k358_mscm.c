@@ -0,0 +1,247 @@
+/*
+ * S32K358 MSCM (core information, inter-core interrupts and interrupt router) emulation
+ *
+ * SPDX-License-Identifier: CC-BY-NC-4.0
+ * Copyright (c) 2025 Braidotti Sara, Iorio Chiara, Pani Matteo.
+ *
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/log.h"
+#include "qemu/module.h"
+#include "qemu/bitops.h"
+#include "qapi/error.h"
+#include "hw/sysbus.h"
+#include "hw/irq.h"
+#include "hw/core/cpu.h"
+#include "hw/qdev-properties.h"
+#include "hw/registerfields.h"
+#include "hw/arm/s32k358_mscm.h"
+#include "migration/vmstate.h"
+
+REG32(CPXNUM, 0x4) // number of the core performing the access
+// Inter-core interrupt status (w1c) and generate registers: 0x20 bytes per target core
+REG32(IRCP0ISR0, 0x200)
+REG32(IRCP3IGR3, 0x27C)
+    FIELD(IRCPIGR, INT, 0, 1)
+REG32(IRCPCFG, 0x400)
+// Interrupt router shared peripheral routing control: one 16 bits register per IRQ
+REG16(IRSPRC0, 0x880)
+    FIELD(IRSPRC, M, 0, 4) // one bit for each core
+    FIELD(IRSPRC, LOCK, 15, 1)
+
+#define IRSPRC_END  (A_IRSPRC0 + 2 * S32K358_MSCM_NUM_IRQ)
+
+// Processor number of the core performing the access
+static int s32k358_mscm_current_core(void)
+{
+    return current_cpu ? S32K358_MSCM_CORE_ID(current_cpu->cpu_index) : 0;
+}
+
+static void s32k358_mscm_update(S32K358MSCM *s, int n)
+{
+    for (int cpu = 0; cpu < s->num_cpu; cpu++) {
+        int core = S32K358_MSCM_CORE_ID(cpu);
+        bool level;
+
+        if (n < S32K358_MSCM_NUM_IRCP)
+            level = s->ircp_isr[core][n] != 0;
+        else
+            level = (s->level[n / 32] & BIT(n % 32)) && (s->irsprc[n] & BIT(core));
+        qemu_set_irq(s->irq_out[cpu][n], level);
+    }
+}
+
+static void s32k358_mscm_set_irq(void *opaque, int n, int level)
+{
+    S32K358MSCM *s = S32K358_MSCM(opaque);
+
+    // IRQ 0...3 are the inter-core interrupts, generated by the MSCM itself
+    if (n < S32K358_MSCM_NUM_IRCP)
+        return;
+
+    if (level)
+        s->level[n / 32] |= BIT(n % 32);
+    else
+        s->level[n / 32] &= ~BIT(n % 32);
+    s32k358_mscm_update(s, n);
+}
+
+static uint64_t s32k358_mscm_read(void *opaque, hwaddr offset, unsigned size)
+{
+    S32K358MSCM *s = S32K358_MSCM(opaque);
+    int core, irq;
+
+    if (offset >= A_IRSPRC0 && offset < IRSPRC_END) {
+        irq = (offset - A_IRSPRC0) / 2;
+        // A 32 bits access reads two routing registers
+        if (size == 4 && irq + 1 < S32K358_MSCM_NUM_IRQ)
+            return s->irsprc[irq] | (s->irsprc[irq + 1] << 16);
+        return s->irsprc[irq];
+    }
+    if (size != 4) {
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "S32K358 MSCM read: bad size %u at offset 0x%x\n", size, (int)offset);
+        return 0;
+    }
+
+    switch (offset) {
+    case A_CPXNUM:
+        return s32k358_mscm_current_core();
+    case A_IRCP0ISR0 ... A_IRCP3IGR3:
+        core = (offset - A_IRCP0ISR0) / 0x20;
+        irq = ((offset - A_IRCP0ISR0) % 0x20) / 8;
+        // The generate registers read as zero
+        return offset & 4 ? 0 : s->ircp_isr[core][irq];
+    default:
+        qemu_log_mask(LOG_UNIMP,
+                      "S32K358 MSCM read: unimplemented offset 0x%x\n", (int)offset);
+        return 0;
+    }
+}
+
+static void s32k358_mscm_write_irsprc(S32K358MSCM *s, int irq, uint16_t value)
+{
+    if (s->irsprc[irq] & R_IRSPRC_LOCK_MASK) {
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "S32K358 MSCM: routing of IRQ %d is locked\n", irq);
+        return;
+    }
+    s->irsprc[irq] = value & (R_IRSPRC_M_MASK | R_IRSPRC_LOCK_MASK);
+    s32k358_mscm_update(s, irq);
+}
+
+static void s32k358_mscm_write(void *opaque, hwaddr offset, uint64_t value,
+                               unsigned size)
+{
+    S32K358MSCM *s = S32K358_MSCM(opaque);
+    int core, irq;
+
+    if (offset >= A_IRSPRC0 && offset < IRSPRC_END) {
+        irq = (offset - A_IRSPRC0) / 2;
+        s32k358_mscm_write_irsprc(s, irq, value);
+        if (size == 4 && irq + 1 < S32K358_MSCM_NUM_IRQ)
+            s32k358_mscm_write_irsprc(s, irq + 1, value >> 16);
+        return;
+    }
+    if (size != 4) {
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "S32K358 MSCM write: bad size %u at offset 0x%x\n", size, (int)offset);
+        return;
+    }
+
+    switch (offset) {
+    case A_IRCP0ISR0 ... A_IRCP3IGR3:
+        core = (offset - A_IRCP0ISR0) / 0x20;
+        irq = ((offset - A_IRCP0ISR0) % 0x20) / 8;
+        if (offset & 4) {
+            // Generate: the interrupt is requested by the core performing the access
+            if (value & R_IRCPIGR_INT_MASK)
+                s->ircp_isr[core][irq] |= BIT(s32k358_mscm_current_core());
+        } else {
+            s->ircp_isr[core][irq] &= ~(value & MAKE_64BIT_MASK(0, S32K358_MSCM_NUM_CORES));
+        }
+        s32k358_mscm_update(s, irq);
+        break;
+    case A_CPXNUM:
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "S32K358 MSCM write: write to Read-Only offset 0x%x\n", (int)offset);
+        break;
+    default:
+        qemu_log_mask(LOG_UNIMP,
+                      "S32K358 MSCM write: unimplemented offset 0x%x\n", (int)offset);
+        break;
+    }
+}
+
+static const MemoryRegionOps s32k358_mscm_ops = {
+    .read = s32k358_mscm_read,
+    .write = s32k358_mscm_write,
+    .endianness = DEVICE_NATIVE_ENDIAN,
+    .valid.min_access_size = 2,
+    .valid.max_access_size = 4,
+};
+
+static void s32k358_mscm_reset(DeviceState *dev)
+{
+    S32K358MSCM *s = S32K358_MSCM(dev);
+
+    memset(s->ircp_isr, 0, sizeof(s->ircp_isr));
+    /*
+     * The peripheral interrupts are routed to CM7_0, so that firmware
+     * written for a single core does not need to program the router
+     */
+    for (int i = 0; i < S32K358_MSCM_NUM_IRQ; i++)
+        s->irsprc[i] = BIT(0);
+    for (int i = 0; i < S32K358_MSCM_NUM_IRQ; i++)
+        s32k358_mscm_update(s, i);
+}
+
+static void s32k358_mscm_init(Object *obj)
+{
+    S32K358MSCM *s = S32K358_MSCM(obj);
+    SysBusDevice *sbd = SYS_BUS_DEVICE(obj);
+
+    memory_region_init_io(&s->iomem, obj, &s32k358_mscm_ops, s,
+                          "s32k358-mscm", 0x4000);
+    sysbus_init_mmio(sbd, &s->iomem);
+    qdev_init_gpio_in_named(DEVICE(obj), s32k358_mscm_set_irq, "irq", S32K358_MSCM_NUM_IRQ);
+}
+
+static void s32k358_mscm_realize(DeviceState *dev, Error **errp)
+{
+    S32K358MSCM *s = S32K358_MSCM(dev);
+
+    if (s->num_cpu < 1 || s->num_cpu > S32K358_MAX_CPUS) {
+        error_setg(errp, "S32K358 MSCM: num-cpu must be between 1 and %d", S32K358_MAX_CPUS);
+        return;
+    }
+    for (int cpu = 0; cpu < s->num_cpu; cpu++) {
+        g_autofree char *name = g_strdup_printf("cpu%d-irq", cpu);
+
+        qdev_init_gpio_out_named(dev, s->irq_out[cpu], name, S32K358_MSCM_NUM_IRQ);
+    }
+}
+
+static const VMStateDescription s32k358_mscm_vmstate = {
+    .name = "s32k358-mscm",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT32_2DARRAY(ircp_isr, S32K358MSCM,
+                               S32K358_MSCM_NUM_CORES, S32K358_MSCM_NUM_IRCP),
+        VMSTATE_UINT16_ARRAY(irsprc, S32K358MSCM, S32K358_MSCM_NUM_IRQ),
+        VMSTATE_UINT32_ARRAY(level, S32K358MSCM, DIV_ROUND_UP(S32K358_MSCM_NUM_IRQ, 32)),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static Property s32k358_mscm_properties[] = {
+    DEFINE_PROP_UINT32("num-cpu", S32K358MSCM, num_cpu, 1),
+    DEFINE_PROP_END_OF_LIST(),
+};
+
+static void s32k358_mscm_class_init(ObjectClass *klass, void *data)
+{
+    DeviceClass *dc = DEVICE_CLASS(klass);
+
+    dc->realize = s32k358_mscm_realize;
+    dc->vmsd = &s32k358_mscm_vmstate;
+    dc->reset = s32k358_mscm_reset;
+    device_class_set_props(dc, s32k358_mscm_properties);
+}
+
+static const TypeInfo s32k358_mscm_info = {
+    .name = TYPE_S32K358_MSCM,
+    .parent = TYPE_SYS_BUS_DEVICE,
+    .instance_size = sizeof(S32K358MSCM),
+    .instance_init = s32k358_mscm_init,
+    .class_init = s32k358_mscm_class_init,
+};
+
+static void s32k358_mscm_register_types(void)
+{
+    type_register_static(&s32k358_mscm_info);
+}
+
+type_init(s32k358_mscm_register_types);
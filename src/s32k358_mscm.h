@@ -0,0 +1,52 @@
+/*
+ * S32K358 MSCM (core information, inter-core interrupts and interrupt router) emulation
+ *
+ * SPDX-License-Identifier: CC-BY-NC-4.0
+ * Copyright (c) 2025 Braidotti Sara, Iorio Chiara, Pani Matteo.
+ *
+ */
+
+#ifndef S32K358_MSCM_H
+#define S32K358_MSCM_H
+
+#include "hw/sysbus.h"
+#include "qom/object.h"
+
+#define TYPE_S32K358_MSCM "s32k358-mscm"
+OBJECT_DECLARE_SIMPLE_TYPE(S32K358MSCM, S32K358_MSCM)
+
+/*
+ * QEMU interface:
+ *  + QOM property "num-cpu": number of emulated cores
+ *  + sysbus MMIO region 0: MSCM registers
+ *  + named GPIO inputs "irq": interrupt requests of the peripherals
+ *  + named GPIO outputs "cpu0-irq" and "cpu1-irq": interrupt lines towards the NVIC of each core
+ */
+
+#define S32K358_MSCM_NUM_IRQ        240
+// Processor numbers in the registers (CM7_0, the CM7_1 checker, CM7_2 and a reserved one)
+#define S32K358_MSCM_NUM_CORES      4
+// Inter-core interrupts, IRQ 0...3 of every core
+#define S32K358_MSCM_NUM_IRCP       4
+// The S32K358 has two independent cores: CM7_0 (in lockstep with CM7_1) and CM7_2
+#define S32K358_MAX_CPUS            2
+#define S32K358_MSCM_CORE_ID(cpu)   ((cpu) * 2)
+
+struct S32K358MSCM {
+    /*< private >*/
+    SysBusDevice parent_obj;
+
+    /*< public >*/
+    MemoryRegion iomem;
+    qemu_irq irq_out[S32K358_MAX_CPUS][S32K358_MSCM_NUM_IRQ];
+    uint32_t num_cpu;
+
+    // Cores that requested each inter-core interrupt: [target core][interrupt]
+    uint32_t ircp_isr[S32K358_MSCM_NUM_CORES][S32K358_MSCM_NUM_IRCP];
+    // Cores each shared peripheral interrupt is routed to (IRSPRCn)
+    uint16_t irsprc[S32K358_MSCM_NUM_IRQ];
+    // Level of the peripheral interrupt requests
+    uint32_t level[DIV_ROUND_UP(S32K358_MSCM_NUM_IRQ, 32)];
+};
+
+#endif
@@ -15,6 +15,7 @@
 #include "hw/irq.h"
 #include "hw/registerfields.h"
 #include "hw/qdev-clock.h"
+#include "hw/qdev-properties.h"
 #include "hw/timer/s32k358_timer.h"
 #include "migration/vmstate.h"
 
@@ -25,7 +26,11 @@ REG32(MCR, 0)
     FIELD(MCR, MDIS, 1, 1) // module disable
     FIELD(MCR, MDIS_RTI, 2, 1) // module disable RTI
 
-// The RIT and the chaining are not modeled, so we do not create the relative registers
+// The RIT is not modeled, so we do not create the relative registers
+
+// Lifetime timer: reading LTMR64H returns CVAL1 and latches CVAL0 in LTMR64L (channels 0 and 1 must be chained)
+REG32(LTMR64H, 0xE0)
+REG32(LTMR64L, 0xE4)
 
 // Timer load value (specifies the length of the timeout peiod in clock cycles)
 REG32(LDVAL0, 0x100)
@@ -90,10 +95,138 @@ static void s32k358_irq_update(S32K358Timer *s)
     qemu_irq_lower(s->timer_irq);
 }
 
+// A chained channel decrements at the expirations of the previous one (channel 0 cannot be chained)
+static bool s32k358_timer_chained(S32K358Timer *s, uint32_t idx)
+{
+    return idx > 0 && (s->timers[idx].ctrl & R_TCTRL0_CHN_MASK);
+}
+
+// Chain mode: channel idx counts the expirations of channel idx - 1
+static void s32k358_timer_chain(S32K358Timer *s, uint32_t idx, uint64_t expirations)
+{
+    struct sub_timer *st;
+    uint64_t count, period, n = 0;
+
+    if (idx >= ARRAY_SIZE(s->timers) || !s32k358_timer_chained(s, idx) ||
+        !(s->timers[idx].ctrl & R_TCTRL0_TEN_MASK) || (s->timer_ctrl & R_MCR_MDIS_MASK)) {
+        return;
+    }
+    st = &s->timers[idx];
+    period = (uint64_t)st->ldval + 1;
+    count = s->lazy ? st->load : ptimer_get_count(st->timer);
+
+    // As for the other channels, the expiration happens when the counter is reloaded from 0
+    if (expirations <= count) {
+        count -= expirations;
+    } else {
+        expirations -= count + 1;
+        n = 1 + expirations / period;
+        count = st->ldval - expirations % period;
+    }
+
+    if (s->lazy) {
+        st->load = count;
+    } else {
+        ptimer_transaction_begin(st->timer);
+        ptimer_set_count(st->timer, count);
+        ptimer_transaction_commit(st->timer);
+    }
+
+    if (n) {
+        st->flag |= R_TFLG0_TIF_MASK;
+        s32k358_irq_update(s);
+        s32k358_timer_chain(s, idx + 1, n);
+    }
+}
+
+/*
+ * Lazy mode: a running channel counts down from "load" starting at
+ * period_start, then from LDVAL. Each expiration lasts one cycle more than
+ * the start value (the cycle in which the counter is reloaded).
+ */
+
+// pclk ticks elapsed since the start of the current period
+static uint64_t s32k358_lazy_elapsed(struct sub_timer *st)
+{
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+
+    return clock_ns_to_ticks(st->parent->pclk, now - st->base_ns) - st->period_start;
+}
+
+// Account the expirations that happened up to now: set TIF and move to the current period
+static void s32k358_lazy_sync(struct sub_timer *st)
+{
+    S32K358Timer *s = st->parent;
+    uint32_t idx = st - s->timers;
+    uint64_t t, n, period = (uint64_t)st->ldval + 1;
+
+    // A chained channel is updated by the previous one
+    if (s32k358_timer_chained(s, idx)) {
+        s32k358_lazy_sync(&s->timers[idx - 1]);
+        return;
+    }
+    if (!st->running) {
+        return;
+    }
+    t = s32k358_lazy_elapsed(st);
+    if (t <= st->load) {
+        return;
+    }
+    st->flag |= R_TFLG0_TIF_MASK;
+    t -= (uint64_t)st->load + 1;
+    n = t / period;
+    st->period_start += (uint64_t)st->load + 1 + n * period;
+    st->load = st->ldval;
+    s32k358_timer_chain(s, idx + 1, n + 1);
+}
+
+static uint32_t s32k358_lazy_count(struct sub_timer *st)
+{
+    s32k358_lazy_sync(st);
+    return st->running ? st->load - s32k358_lazy_elapsed(st) : st->load;
+}
+
+// Arm the host timer at the next expiration, only if the channel can raise the interrupt
+// or if the next channel is chained to it
+static void s32k358_lazy_arm(struct sub_timer *st)
+{
+    S32K358Timer *s = st->parent;
+    uint32_t idx = st - s->timers;
+    uint64_t ticks = st->period_start + st->load + 1;
+    bool events = (st->ctrl & R_TCTRL0_TIE_MASK) ||
+                  (idx + 1 < ARRAY_SIZE(s->timers) && s32k358_timer_chained(s, idx + 1) &&
+                   (s->timers[idx + 1].ctrl & R_TCTRL0_TEN_MASK));
+
+    if (st->running && events && clock_is_enabled(s->pclk)) {
+        // one more nanosecond, since the conversion to ns rounds down
+        timer_mod(st->irq_timer, st->base_ns + clock_ticks_to_ns(st->parent->pclk, ticks) + 1);
+    } else {
+        timer_del(st->irq_timer);
+    }
+}
+
+// Restart the counting from the current value (the clock period or the channel state changed)
+static void s32k358_lazy_rebase(struct sub_timer *st, bool running)
+{
+    st->load = s32k358_lazy_count(st);
+    st->base_ns = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    st->period_start = 0;
+    st->running = running;
+    s32k358_lazy_arm(st);
+}
+
+static uint32_t s32k358_timer_count(S32K358Timer *s, uint32_t idx)
+{
+    if (s->lazy)
+        return s32k358_lazy_count(&s->timers[idx]);
+    return ptimer_get_count(s->timers[idx].timer);
+}
+
 // Function that allows to read the registers' values
 static uint64_t s32k358_timer_read(void *opaque, hwaddr offset, unsigned size)
 {
     S32K358Timer *s = S32K358_TIMER(opaque);
+    uint32_t idx;
     uint64_t r;
 
     switch (offset) {
@@ -113,21 +246,33 @@ static uint64_t s32k358_timer_read(void *opaque, hwaddr offset, unsigned size)
         case A_CVAL1:
         case A_CVAL2:
         case A_CVAL3:
-            r = ptimer_get_count(s->timers[(offset-A_CVAL0) / (A_CVAL1-A_CVAL0)].timer);
+            r = s32k358_timer_count(s, (offset-A_CVAL0) / (A_CVAL1-A_CVAL0));
+            break;
+        // Lifetime timer
+        case A_LTMR64H:
+            r = s32k358_timer_count(s, 1);
+            s->ltmr64l = s32k358_timer_count(s, 0);
+            break;
+        case A_LTMR64L:
+            r = s->ltmr64l;
             break;
         // Timer Load Value (LDVAL0, LDVAL1, LDVAL2, LDVAL3)
         case A_LDVAL0:
         case A_LDVAL1:
         case A_LDVAL2:
         case A_LDVAL3:
-            r = ptimer_get_limit(s->timers[(offset-A_LDVAL0) / (A_LDVAL1-A_LDVAL0)].timer);
+            r = s->timers[(offset-A_LDVAL0) / (A_LDVAL1-A_LDVAL0)].ldval;
             break;
         // Timer Flag (TFLG0, TFLG1, TFLG2, TFLG3)
         case A_TFLG0:
         case A_TFLG1:
         case A_TFLG2:
         case A_TFLG3:
-            r = s->timers[(offset-A_TFLG0) / (A_TFLG1-A_TFLG0)].flag;
+            idx = (offset-A_TFLG0) / (A_TFLG1-A_TFLG0);
+            // In lazy mode the flag of a channel without interrupts is updated only here
+            if (s->lazy)
+                s32k358_lazy_sync(&s->timers[idx]);
+            r = s->timers[idx].flag;
             break;
         default: {
             qemu_log_mask(LOG_GUEST_ERROR,
@@ -142,8 +287,20 @@ static uint64_t s32k358_timer_read(void *opaque, hwaddr offset, unsigned size)
 
 // To switch on/off the timer (since it may be enabled/disabled through the s32k358_timer_write funtion)
 static void s32k358_timer_switch_on_off(S32K358Timer *s, uint32_t idx) {
+    // A chained channel does not count the clock cycles
+    bool running = (s->timers[idx].ctrl & R_TCTRL0_TEN_MASK) && !(s->timer_ctrl & R_MCR_MDIS_MASK) &&
+                   !s32k358_timer_chained(s, idx);
+
+    if (s->lazy) {
+
+        if (running != s->timers[idx].running)
+            s32k358_lazy_rebase(&s->timers[idx], running);
+        else
+            s32k358_lazy_arm(&s->timers[idx]);
+        return;
+    }
     ptimer_transaction_begin(s->timers[idx].timer);
-    if ((s->timers[idx].ctrl & R_TCTRL0_TEN_MASK) && !(s->timer_ctrl & R_MCR_MDIS_MASK)) {
+    if (running) {
         ptimer_run(s->timers[idx].timer, 0 /* reloadable timer */);
     } else {
         ptimer_stop(s->timers[idx].timer);
@@ -181,19 +338,19 @@ static void s32k358_timer_write(void *opaque, hwaddr offset, uint64_t value,
     case A_TCTRL3:
         // derive the channel
         idx = (offset-A_TCTRL0) / (A_TCTRL1-A_TCTRL0);
+        // the counter runs with the old configuration up to now: freeze it
+        if (s->lazy)
+            s32k358_lazy_rebase(&s->timers[idx], false);
         // modify only the last three bits, the others are reserved
         s->timers[idx].ctrl = value & (R_TCTRL0_CHN_MASK | R_TCTRL0_TEN_MASK | R_TCTRL0_TIE_MASK);
-        // Changing the CHN will have no effect
-        if (value & R_TCTRL0_CHN_MASK) {
-            // We don't model this.
-            qemu_log_mask(LOG_UNIMP,
-                          "S32K358 timer: CHN input not supported\n");
-        }
 
         // if TIF is enabled, changing the timer interrupt enable triggers an interupt (manual - page 2830)
         s32k358_irq_update(s);
         // If enable the timer, reset it
         s32k358_timer_switch_on_off(s, idx);
+        // The previous channel must signal its expirations if this one is chained to it
+        if (s->lazy && idx > 0)
+            s32k358_lazy_arm(&s->timers[idx - 1]);
 
         break;
     // Timer Flag (TFLG0, TFLG1, TFLG2, TFLG3)
@@ -201,8 +358,11 @@ static void s32k358_timer_write(void *opaque, hwaddr offset, uint64_t value,
     case A_TFLG1:
     case A_TFLG2:
     case A_TFLG3:
+        idx = (offset-A_TFLG0) / (A_TFLG1-A_TFLG0);
         value &= R_TFLG0_TIF_MASK;
-        s->timers[(offset-A_TFLG0) / (A_TFLG1-A_TFLG0)].flag &= ~value;
+        if (s->lazy)
+            s32k358_lazy_sync(&s->timers[idx]);
+        s->timers[idx].flag &= ~value;
         // if TIF=1, it may have to trigger the interrupt
         s32k358_irq_update(s);
         break;
@@ -213,13 +373,22 @@ static void s32k358_timer_write(void *opaque, hwaddr offset, uint64_t value,
     case A_LDVAL3:
         idx = (offset-A_LDVAL0) / (A_LDVAL1-A_LDVAL0);
 
+        if (s->lazy) {
+            // The new value is loaded at the next expiration
+            s32k358_lazy_sync(&s->timers[idx]);
+            s->timers[idx].ldval = value;
+            s32k358_lazy_arm(&s->timers[idx]);
+            break;
+        }
+        s->timers[idx].ldval = value;
         ptimer_transaction_begin(s->timers[idx].timer);
         // Do not reload immediately the timer, wait that it expires before loading the new value
         // Hence, change the reload value but not the CVAL one
         ptimer_set_limit(s->timers[idx].timer, value, 0);
         // Check if the pit and line of the timer are enabled
         // R_TCTRL0_TEN_MASK is the same for all the registers
-        if (!(s->timer_ctrl & R_MCR_MDIS_MASK) && (s->timers[idx].ctrl & R_TCTRL0_TEN_MASK)) {
+        if (!(s->timer_ctrl & R_MCR_MDIS_MASK) && (s->timers[idx].ctrl & R_TCTRL0_TEN_MASK) &&
+            !s32k358_timer_chained(s, idx)) {
             // Make sure timer is running (it doesn't reset it if it was already)
             ptimer_run(s->timers[idx].timer, 0 /* reloadable timer */);
         }
@@ -260,16 +429,33 @@ static void s32k358_timer_tick(void *opaque)
     if (st->ctrl & R_TCTRL0_TIE_MASK) {
         qemu_irq_raise(st->parent->timer_irq);
     }
+    // the next channel may be chained to this one
+    s32k358_timer_chain(st->parent, st - st->parent->timers + 1, 1);
+}
+
+// Lazy mode: function called at the expiration of a channel with interrupts enabled
+static void s32k358_timer_lazy_tick(void *opaque)
+{
+    struct sub_timer *st = (struct sub_timer*)opaque;
+
+    s32k358_lazy_sync(st);
+    s32k358_irq_update(st->parent);
+    s32k358_lazy_arm(st);
 }
 
 static void s32k358_timer_reset(DeviceState *dev)
 {
     S32K358Timer *s = S32K358_TIMER(dev);
 
+    s->ltmr64l = 0;
     for (int i = 0; i < ARRAY_SIZE(s->timers); i++) {
         /* Set the ctrl and tif */
         s->timers[i].ctrl = 0;
         s->timers[i].flag = 0;
+        s->timers[i].ldval = 0;
+        s->timers[i].running = false;
+        s->timers[i].load = 0;
+        timer_del(s->timers[i].irq_timer);
         ptimer_transaction_begin(s->timers[i].timer);
         ptimer_stop(s->timers[i].timer);
         /* Set the limit */
@@ -283,6 +469,13 @@ static void s32k358_timer_clk_update(void *opaque, ClockEvent event)
 {
     S32K358Timer *s = S32K358_TIMER(opaque);
     for (int i = 0; i < ARRAY_SIZE(s->timers); i++) {
+        if (s->lazy) {
+            // before the change the elapsed time is counted with the old period, then restart from there
+            s32k358_lazy_rebase(&s->timers[i], s->timers[i].running);
+            continue;
+        }
+        if (event != ClockUpdate)
+            continue;
         ptimer_transaction_begin(s->timers[i].timer);
         ptimer_set_period_from_clock(s->timers[i].timer, s->pclk, 1);
         ptimer_transaction_commit(s->timers[i].timer);
@@ -301,7 +494,8 @@ static void s32k358_timer_init(Object *obj)
     // Connect the irq line and clock
     sysbus_init_irq(sbd, &s->timer_irq);
     s->pclk = qdev_init_clock_in(DEVICE(s), "pclk",
-                                 s32k358_timer_clk_update, s, ClockUpdate);
+                                 s32k358_timer_clk_update, s,
+                                 ClockPreUpdate | ClockUpdate);
 }
 
 static void s32k358_timer_realize(DeviceState *dev, Error **errp)
@@ -315,6 +509,8 @@ static void s32k358_timer_realize(DeviceState *dev, Error **errp)
 
     for (int i = 0; i < ARRAY_SIZE(s -> timers); i++) {
         s->timers[i].parent = s;
+        s->timers[i].irq_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, s32k358_timer_lazy_tick,
+                                              &(s->timers[i]));
         // Init the four channels
         s->timers[i].timer = ptimer_init(s32k358_timer_tick, &(s->timers[i]),
                            PTIMER_POLICY_WRAP_AFTER_ONE_PERIOD |
@@ -328,17 +524,94 @@ static void s32k358_timer_realize(DeviceState *dev, Error **errp)
     }
 }
 
+static const VMStateDescription s32k358_sub_timer_vmstate = {
+    .name = "s32k358-timer-channel",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (const VMStateField[]) {
+        VMSTATE_PTIMER(timer, struct sub_timer),
+        VMSTATE_UINT32(ctrl, struct sub_timer),
+        VMSTATE_UINT32(flag, struct sub_timer),
+        VMSTATE_UINT32(ldval, struct sub_timer),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+// Lazy mode: the counters are described by their start time instead of the ptimers
+static const VMStateDescription s32k358_sub_timer_lazy_vmstate = {
+    .name = "s32k358-timer-channel/lazy",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (const VMStateField[]) {
+        VMSTATE_BOOL(running, struct sub_timer),
+        VMSTATE_INT64(base_ns, struct sub_timer),
+        VMSTATE_UINT64(period_start, struct sub_timer),
+        VMSTATE_UINT32(load, struct sub_timer),
+        VMSTATE_TIMER_PTR(irq_timer, struct sub_timer),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static bool s32k358_timer_lazy_needed(void *opaque)
+{
+    S32K358Timer *s = S32K358_TIMER(opaque);
+
+    return s->lazy;
+}
+
+static const VMStateDescription s32k358_timer_lazy_vmstate = {
+    .name = "s32k358-timer/lazy",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .needed = s32k358_timer_lazy_needed,
+    .fields = (const VMStateField[]) {
+        VMSTATE_STRUCT_ARRAY(timers, S32K358Timer, 4, 1,
+                             s32k358_sub_timer_lazy_vmstate, struct sub_timer),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static bool s32k358_timer_lifetime_needed(void *opaque)
+{
+    S32K358Timer *s = S32K358_TIMER(opaque);
+
+    return s->ltmr64l != 0;
+}
+
+static const VMStateDescription s32k358_timer_lifetime_vmstate = {
+    .name = "s32k358-timer/lifetime",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .needed = s32k358_timer_lifetime_needed,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT32(ltmr64l, S32K358Timer),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
 static const VMStateDescription s32k358_timer_vmstate = {
     .name = "s32k358-timer",
-    .version_id = 2,
+    .version_id = 3,
     .minimum_version_id = 2,
-    // only public field, irq and pclk
     .fields = (const VMStateField[]) {
         VMSTATE_CLOCK(pclk, S32K358Timer),
+        VMSTATE_UINT32_V(timer_ctrl, S32K358Timer, 3),
+        VMSTATE_STRUCT_ARRAY(timers, S32K358Timer, 4, 3,
+                             s32k358_sub_timer_vmstate, struct sub_timer),
         VMSTATE_END_OF_LIST()
+    },
+    .subsections = (const VMStateDescription * const []) {
+        &s32k358_timer_lazy_vmstate,
+        &s32k358_timer_lifetime_vmstate,
+        NULL
     }
 };
 
+static Property s32k358_timer_properties[] = {
+    DEFINE_PROP_BOOL("lazy", S32K358Timer, lazy, false),
+    DEFINE_PROP_END_OF_LIST(),
+};
+
 static void s32k358_timer_class_init(ObjectClass *klass, void *data)
 {
     DeviceClass *dc = DEVICE_CLASS(klass);
@@ -346,6 +619,7 @@ static void s32k358_timer_class_init(ObjectClass *klass, void *data)
     dc->realize = s32k358_timer_realize;
     dc->vmsd = &s32k358_timer_vmstate;
     dc->reset = s32k358_timer_reset;
+    device_class_set_props(dc, s32k358_timer_properties);
 }
 
 static const TypeInfo s32k358_timer_info = {
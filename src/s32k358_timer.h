@@ -12,6 +12,7 @@
 #include "hw/sysbus.h"
 #include "hw/ptimer.h"
 #include "hw/clock.h"
+#include "qemu/timer.h"
 #include "qom/object.h"
 
 #define TYPE_S32K358_TIMER "s32k358-timer"
@@ -20,6 +21,7 @@ OBJECT_DECLARE_SIMPLE_TYPE(S32K358Timer, S32K358_TIMER)
 /*
  * QEMU interface:
  *  + Clock input "pclk": clock for the timer
+ *  + QOM property "lazy": derive the channels without interrupts from the virtual clock
  *  + sysbus MMIO region 0: the register bank
  *  + sysbus IRQ 0: timer interrupt
  */
@@ -32,6 +34,13 @@ struct sub_timer {
     struct ptimer_state *timer;
     uint32_t ctrl;
     uint32_t flag;
+    uint32_t ldval;
+    // Lazy mode: the counter is computed from the virtual clock when it is read
+    QEMUTimer *irq_timer; // armed only when TIE is set
+    bool running;
+    int64_t base_ns; // virtual time at which the channel was started
+    uint64_t period_start; // pclk ticks from base_ns to the start of the current period
+    uint32_t load; // counter value at the start of the current period
 };
 
 // Data structure representing the PIT (periodic interrupt timer)
@@ -45,6 +54,8 @@ struct S32K358Timer {
 
     Clock *pclk;
     uint32_t timer_ctrl;
+    uint32_t ltmr64l; // lower half of the lifetime timer, latched when LTMR64H is read
+    bool lazy;
     struct sub_timer timers[4]; // the timer has 4 channels
 };
 
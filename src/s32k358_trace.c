@@ -0,0 +1,329 @@
+/*
+ * S32K358 ITM stimulus ports and DWT cycle counter emulation
+ *
+ * SPDX-License-Identifier: CC-BY-NC-4.0
+ * Copyright (c) 2025 Braidotti Sara, Iorio Chiara, Pani Matteo.
+ *
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/log.h"
+#include "qemu/module.h"
+#include "qemu/timer.h"
+#include "qapi/error.h"
+#include "hw/sysbus.h"
+#include "hw/qdev-clock.h"
+#include "hw/qdev-properties.h"
+#include "hw/qdev-properties-system.h"
+#include "hw/registerfields.h"
+#include "hw/arm/s32k358_trace.h"
+#include "migration/vmstate.h"
+
+// ITM registers
+REG32(ITM_STIM0, 0x0) // stimulus ports 0...31
+REG32(ITM_STIM31, 0x7C)
+    FIELD(ITM_STIM, FIFOREADY, 0, 1)
+REG32(ITM_TER, 0xE00) // trace enable, one bit per port
+REG32(ITM_TPR, 0xE40) // trace privilege
+REG32(ITM_TCR, 0xE80) // trace control
+    FIELD(ITM_TCR, ITMENA, 0, 1)
+    FIELD(ITM_TCR, BUSY, 23, 1)
+
+// DWT registers
+REG32(DWT_CTRL, 0x0)
+    FIELD(DWT_CTRL, CYCCNTENA, 0, 1)
+    FIELD(DWT_CTRL, NOPRFCNT, 24, 1) // the profiling counters are not implemented
+    FIELD(DWT_CTRL, NOCYCCNT, 25, 1)
+    FIELD(DWT_CTRL, NOEXTTRIG, 26, 1)
+    FIELD(DWT_CTRL, NOTRCPKT, 27, 1)
+    FIELD(DWT_CTRL, NUMCOMP, 28, 4)
+REG32(DWT_CYCCNT, 0x4)
+
+// CoreSight software lock, common to the ITM and the DWT
+REG32(LAR, 0xFB0)
+REG32(LSR, 0xFB4)
+    FIELD(LSR, SLI, 0, 1) // lock implemented
+    FIELD(LSR, SLK, 1, 1) // locked
+#define LAR_KEY 0xC5ACCE55
+
+// Header of an SWO instrumentation packet: port number and payload size
+static uint8_t s32k358_itm_header(int port, unsigned size)
+{
+    return (port << 3) | (size == 4 ? 3 : size);
+}
+
+static uint64_t s32k358_itm_read(void *opaque, hwaddr offset, unsigned size)
+{
+    struct trace_core *c = opaque;
+
+    switch (offset) {
+    case A_ITM_STIM0 ... A_ITM_STIM31 + 3:
+        // The port is always ready: a write is never delayed
+        return R_ITM_STIM_FIFOREADY_MASK;
+    case A_ITM_TER:
+        return c->itm_ter;
+    case A_ITM_TPR:
+        return c->itm_tpr;
+    case A_ITM_TCR:
+        return c->itm_tcr;
+    case A_LSR:
+        return R_LSR_SLI_MASK | (c->itm_locked ? R_LSR_SLK_MASK : 0);
+    default:
+        qemu_log_mask(LOG_UNIMP,
+                      "S32K358 ITM read: unimplemented offset 0x%x\n", (int)offset);
+        return 0;
+    }
+}
+
+static void s32k358_itm_write(void *opaque, hwaddr offset, uint64_t value,
+                              unsigned size)
+{
+    struct trace_core *c = opaque;
+    S32K358Trace *s = c->parent;
+    uint8_t packet[5];
+    int port;
+
+    if (offset <= A_ITM_STIM31 + 3) {
+        port = offset / 4;
+        if (!(c->itm_tcr & R_ITM_TCR_ITMENA_MASK) || !(c->itm_ter & BIT(port)))
+            return;
+        // SWO has no flow control: the packet is written at once
+        packet[0] = s32k358_itm_header(port, size);
+        stn_le_p(packet + 1, size, value);
+        qemu_chr_fe_write_all(&s->chr, packet, 1 + size);
+        return;
+    }
+
+    if (offset == A_LAR) {
+        c->itm_locked = value != LAR_KEY;
+        return;
+    }
+    if (c->itm_locked) {
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "S32K358 ITM: write to offset 0x%x while locked (see ITM_LAR)\n", (int)offset);
+        return;
+    }
+
+    switch (offset) {
+    case A_ITM_TER:
+        c->itm_ter = value;
+        break;
+    case A_ITM_TPR:
+        c->itm_tpr = value;
+        break;
+    case A_ITM_TCR:
+        c->itm_tcr = value & ~R_ITM_TCR_BUSY_MASK;
+        break;
+    case A_LSR:
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "S32K358 ITM write: write to Read-Only offset 0x%x\n", (int)offset);
+        break;
+    default:
+        qemu_log_mask(LOG_UNIMP,
+                      "S32K358 ITM write: unimplemented offset 0x%x\n", (int)offset);
+        break;
+    }
+}
+
+static const MemoryRegionOps s32k358_itm_ops = {
+    .read = s32k358_itm_read,
+    .write = s32k358_itm_write,
+    .endianness = DEVICE_NATIVE_ENDIAN,
+    .valid.min_access_size = 1,
+    .valid.max_access_size = 4,
+};
+
+// Cycles counted since sync_ns are added to the value of CYCCNT at that time
+static uint32_t s32k358_dwt_cyccnt(struct trace_core *c)
+{
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+
+    if (!(c->dwt_ctrl & R_DWT_CTRL_CYCCNTENA_MASK))
+        return c->cyccnt;
+    return c->cyccnt + clock_ns_to_ticks(c->parent->cpuclk, now - c->sync_ns);
+}
+
+static void s32k358_dwt_sync(struct trace_core *c)
+{
+    c->cyccnt = s32k358_dwt_cyccnt(c);
+    c->sync_ns = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+}
+
+static uint64_t s32k358_dwt_read(void *opaque, hwaddr offset, unsigned size)
+{
+    struct trace_core *c = opaque;
+
+    switch (offset) {
+    case A_DWT_CTRL:
+        return c->dwt_ctrl | R_DWT_CTRL_NOPRFCNT_MASK | R_DWT_CTRL_NOEXTTRIG_MASK |
+               R_DWT_CTRL_NOTRCPKT_MASK;
+    case A_DWT_CYCCNT:
+        return s32k358_dwt_cyccnt(c);
+    case A_LSR:
+        return R_LSR_SLI_MASK | (c->dwt_locked ? R_LSR_SLK_MASK : 0);
+    default:
+        qemu_log_mask(LOG_UNIMP,
+                      "S32K358 DWT read: unimplemented offset 0x%x\n", (int)offset);
+        return 0;
+    }
+}
+
+static void s32k358_dwt_write(void *opaque, hwaddr offset, uint64_t value,
+                              unsigned size)
+{
+    struct trace_core *c = opaque;
+
+    if (offset == A_LAR) {
+        c->dwt_locked = value != LAR_KEY;
+        return;
+    }
+    if (c->dwt_locked) {
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "S32K358 DWT: write to offset 0x%x while locked (see DWT_LAR)\n", (int)offset);
+        return;
+    }
+
+    switch (offset) {
+    case A_DWT_CTRL:
+        s32k358_dwt_sync(c);
+        // Only CYCCNTENA is implemented, the comparators and the other counters are not
+        c->dwt_ctrl = value & R_DWT_CTRL_CYCCNTENA_MASK;
+        break;
+    case A_DWT_CYCCNT:
+        c->cyccnt = value;
+        c->sync_ns = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+        break;
+    case A_LSR:
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "S32K358 DWT write: write to Read-Only offset 0x%x\n", (int)offset);
+        break;
+    default:
+        qemu_log_mask(LOG_UNIMP,
+                      "S32K358 DWT write: unimplemented offset 0x%x\n", (int)offset);
+        break;
+    }
+}
+
+static const MemoryRegionOps s32k358_dwt_ops = {
+    .read = s32k358_dwt_read,
+    .write = s32k358_dwt_write,
+    .endianness = DEVICE_NATIVE_ENDIAN,
+    .valid.min_access_size = 4,
+    .valid.max_access_size = 4,
+};
+
+// The cycles counted at the old frequency are accumulated before it changes
+static void s32k358_trace_clk_update(void *opaque, ClockEvent event)
+{
+    S32K358Trace *s = S32K358_TRACE(opaque);
+
+    for (int i = 0; i < S32K358_MAX_CPUS; i++)
+        s32k358_dwt_sync(&s->cores[i]);
+}
+
+static void s32k358_trace_reset(DeviceState *dev)
+{
+    S32K358Trace *s = S32K358_TRACE(dev);
+
+    for (int i = 0; i < S32K358_MAX_CPUS; i++) {
+        struct trace_core *c = &s->cores[i];
+
+        c->itm_ter = 0;
+        c->itm_tpr = 0;
+        c->itm_tcr = 0;
+        c->itm_locked = true;
+        c->dwt_ctrl = 0;
+        c->cyccnt = 0;
+        c->sync_ns = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+        c->dwt_locked = true;
+    }
+}
+
+static void s32k358_trace_init(Object *obj)
+{
+    S32K358Trace *s = S32K358_TRACE(obj);
+    SysBusDevice *sbd = SYS_BUS_DEVICE(obj);
+
+    for (int i = 0; i < S32K358_MAX_CPUS; i++) {
+        struct trace_core *c = &s->cores[i];
+
+        c->parent = s;
+        memory_region_init_io(&c->itm_iomem, obj, &s32k358_itm_ops, c,
+                              "s32k358-itm", 0x1000);
+        sysbus_init_mmio(sbd, &c->itm_iomem);
+        memory_region_init_io(&c->dwt_iomem, obj, &s32k358_dwt_ops, c,
+                              "s32k358-dwt", 0x1000);
+        sysbus_init_mmio(sbd, &c->dwt_iomem);
+    }
+    s->cpuclk = qdev_init_clock_in(DEVICE(s), "cpuclk", s32k358_trace_clk_update, s,
+                                   ClockPreUpdate);
+}
+
+static void s32k358_trace_realize(DeviceState *dev, Error **errp)
+{
+    S32K358Trace *s = S32K358_TRACE(dev);
+
+    if (!clock_has_source(s->cpuclk)) {
+        error_setg(errp, "S32K358 trace: cpuclk clock must be connected");
+        return;
+    }
+}
+
+static const VMStateDescription s32k358_trace_core_vmstate = {
+    .name = "s32k358-trace-core",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT32(itm_ter, struct trace_core),
+        VMSTATE_UINT32(itm_tpr, struct trace_core),
+        VMSTATE_UINT32(itm_tcr, struct trace_core),
+        VMSTATE_BOOL(itm_locked, struct trace_core),
+        VMSTATE_UINT32(dwt_ctrl, struct trace_core),
+        VMSTATE_UINT32(cyccnt, struct trace_core),
+        VMSTATE_INT64(sync_ns, struct trace_core),
+        VMSTATE_BOOL(dwt_locked, struct trace_core),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static const VMStateDescription s32k358_trace_vmstate = {
+    .name = "s32k358-trace",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (const VMStateField[]) {
+        VMSTATE_CLOCK(cpuclk, S32K358Trace),
+        VMSTATE_STRUCT_ARRAY(cores, S32K358Trace, S32K358_MAX_CPUS, 1,
+                             s32k358_trace_core_vmstate, struct trace_core),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static Property s32k358_trace_properties[] = {
+    DEFINE_PROP_CHR("chardev", S32K358Trace, chr),
+    DEFINE_PROP_END_OF_LIST(),
+};
+
+static void s32k358_trace_class_init(ObjectClass *klass, void *data)
+{
+    DeviceClass *dc = DEVICE_CLASS(klass);
+
+    dc->realize = s32k358_trace_realize;
+    dc->vmsd = &s32k358_trace_vmstate;
+    dc->reset = s32k358_trace_reset;
+    device_class_set_props(dc, s32k358_trace_properties);
+}
+
+static const TypeInfo s32k358_trace_info = {
+    .name = TYPE_S32K358_TRACE,
+    .parent = TYPE_SYS_BUS_DEVICE,
+    .instance_size = sizeof(S32K358Trace),
+    .instance_init = s32k358_trace_init,
+    .class_init = s32k358_trace_class_init,
+};
+
+static void s32k358_trace_register_types(void)
+{
+    type_register_static(&s32k358_trace_info);
+}
+
+type_init(s32k358_trace_register_types);
@@ -0,0 +1,62 @@
+/*
+ * S32K358 ITM stimulus ports and DWT cycle counter emulation
+ *
+ * SPDX-License-Identifier: CC-BY-NC-4.0
+ * Copyright (c) 2025 Braidotti Sara, Iorio Chiara, Pani Matteo.
+ *
+ */
+
+#ifndef S32K358_TRACE_H
+#define S32K358_TRACE_H
+
+#include "hw/sysbus.h"
+#include "hw/clock.h"
+#include "chardev/char-fe.h"
+#include "qom/object.h"
+#include "hw/arm/s32k358_mscm.h"
+
+#define TYPE_S32K358_TRACE "s32k358-trace"
+OBJECT_DECLARE_SIMPLE_TYPE(S32K358Trace, S32K358_TRACE)
+
+/*
+ * QEMU interface:
+ *  + QOM property "chardev": SWO output, shared by the ITMs of all the cores
+ *  + Clock input "cpuclk": clock counted by the DWT cycle counters
+ *  + sysbus MMIO region 2n: ITM of core n (to be mapped at 0xE0000000 in its PPB)
+ *  + sysbus MMIO region 2n + 1: DWT of core n (to be mapped at 0xE0001000 in its PPB)
+ */
+
+#define S32K358_ITM_BASE    0xE0000000
+#define S32K358_DWT_BASE    0xE0001000
+#define S32K358_ITM_PORTS   32
+
+struct S32K358Trace;
+
+// ITM and DWT of a core
+struct trace_core {
+    struct S32K358Trace *parent;
+    MemoryRegion itm_iomem;
+    MemoryRegion dwt_iomem;
+    // ITM
+    uint32_t itm_ter;
+    uint32_t itm_tpr;
+    uint32_t itm_tcr;
+    bool itm_locked;
+    // DWT
+    uint32_t dwt_ctrl;
+    uint32_t cyccnt; // value of CYCCNT at sync_ns
+    int64_t sync_ns;
+    bool dwt_locked;
+};
+
+struct S32K358Trace {
+    /*< private >*/
+    SysBusDevice parent_obj;
+
+    /*< public >*/
+    CharBackend chr;
+    Clock *cpuclk;
+    struct trace_core cores[S32K358_MAX_CPUS];
+};
+
+#endif
@@ -19,6 +19,8 @@
 #include "hw/char/s32k358_uart.h"
 #include "hw/irq.h"
 #include "hw/qdev-properties-system.h"
+#include "hw/qdev-clock.h"
+#include "qemu/main-loop.h"
 
 REG32(VERID, 0x0) // Indicates the version integrated for this instance
 REG32(PARAM, 0x4) // Indicates the parameter configuration for this instance on the chi
@@ -28,21 +30,37 @@ REG32(BAUD, 0x10) // Configures the baud rate
     FIELD(BAUD, SBR, 0, 13) // Baud Rate Modulo Divisor
     FIELD(BAUD, SBNS, 13, 1) // Stop Bit Number Select
     FIELD(BAUD, BOTHEDGE, 17, 1) // Both Edge Sampling
+    FIELD(BAUD, RIDMAE, 20, 1) // Receiver Idle DMA Enable
+    FIELD(BAUD, RDMAE, 21, 1) // Receiver Full DMA Enable
+    FIELD(BAUD, TDMAE, 23, 1) // Transmitter DMA Enable
     FIELD(BAUD, OSR, 24, 5) // Oversampling Ratio
 REG32(STAT, 0x14) // Provides the module status.
+    FIELD(STAT, IDLE, 20, 1) // Idle Line Flag
     FIELD(STAT, RDRF, 21, 1) // Receive Data Register Full Flag
     FIELD(STAT, TC, 22, 1) // Transmission Complete Flag
     FIELD(STAT, TDRE, 23, 1) // Transmit Data Register Empty Flag
 REG32(CTRL, 0x18) // Controls various optional features of the LPUART system.
     FIELD(CTRL, PT, 0, 1) // Parity Type
     FIELD(CTRL, PE, 1, 1) // Parity Enable
+    FIELD(CTRL, ILT, 2, 1) // Idle Line Type Select
+    FIELD(CTRL, IDLECFG, 8, 3) // Idle Configuration
     FIELD(CTRL, RE, 18, 1) // Receiver Enable
     FIELD(CTRL, TE, 19, 1) // Transmitter Enable
+    FIELD(CTRL, ILIE, 20, 1) // Idle Line Interrupt Enable
     FIELD(CTRL, RIE, 21, 1) // Receiver Interrupt Enable
     FIELD(CTRL, TCIE, 22, 1) // Transmission Complete Interrupt Enable
     FIELD(CTRL, TIE, 23, 1) // Transmit Interrupt Enable
 REG32(DATA, 0x1C)  // Read receive FIFO bits 0-7 or write transmit FIFO bit 0-7
     FIELD(DATA, R07T07, 0, 8)
+REG32(MODIR, 0x24) // Configures the modem and infrared functions
+    FIELD(MODIR, TXCTSE, 0, 1) // Transmitter CTS Enable
+    FIELD(MODIR, TXRTSE, 1, 1) // Transmitter RTS Enable
+    FIELD(MODIR, TXRTSPOL, 2, 1) // Transmitter RTS Polarity
+    FIELD(MODIR, RXRTSE, 3, 1) // Receiver RTS Enable
+    FIELD(MODIR, TXCTSC, 4, 1) // Transmit CTS Configuration
+    FIELD(MODIR, TXCTSSRC, 5, 1) // Transmit CTS Source
+    FIELD(MODIR, RTSWATER, 8, 4) // Receive RTS Configuration
+    FIELD(MODIR, RTSWATER_SHORT, 8, 2) // Receive RTS Configuration
 REG32(FIFO, 0x28) // Provides you the ability to turn on and turn off the FIFO functionality.
     FIELD(FIFO, RXFIFOSIZE, 0, 3) // Receive FIFO Buffer Depth
     FIELD(FIFO, RXFE, 3, 1) // Receive FIFO Enable
@@ -50,6 +68,7 @@ REG32(FIFO, 0x28) // Provides you the ability to turn on and turn off the FIFO f
     FIELD(FIFO, TXFE, 7, 1) // Transmit FIFO Enable
     FIELD(FIFO, RXUFE, 8, 1) // Receive FIFO Underflow Interrupt Enable
     FIELD(FIFO, TXOFE, 9, 1) // Transmit FIFO Overflow Interrupt Enable
+    FIELD(FIFO, RXIDEN, 10, 3) // Receiver Idle Empty Enable
     FIELD(FIFO, RXFLUSH, 14, 1) // Receive FIFO Flush
     FIELD(FIFO, TXFLUSH, 15, 1) // Transmit FIFO Flush
     FIELD(FIFO, RXUF, 16, 1) // Receiver FIFO Underflow Flag
@@ -64,6 +83,30 @@ REG32(WATER, 0x2C) // Provides the ability to set a programmable threshold for n
     FIELD(WATER, RXWATER_SHORT, 16, 2) // Receive Watermark
     FIELD(WATER, RXCOUNT, 24, 5) // Receive Counter
 
+// Index into a FIFO ring buffer
+#define LPUART_FIFO_IDX(i) ((i) & (S32K358_LPUART_FIFO_CAPACITY - 1))
+
+// Copy @n bytes from @buf to the tail of the ring buffer @fifo
+static void lpuart_fifo_push(uint8_t *fifo, uint8_t head, uint8_t written,
+                             const uint8_t *buf, uint32_t n)
+{
+    uint32_t tail = LPUART_FIFO_IDX(head + written);
+    uint32_t first = MIN(n, S32K358_LPUART_FIFO_CAPACITY - tail);
+
+    memcpy(fifo + tail, buf, first);
+    memcpy(fifo, buf + first, n - first);
+}
+
+// Copy @n bytes from the head of the ring buffer @fifo to @buf
+static void lpuart_fifo_peek(const uint8_t *fifo, uint8_t head,
+                             uint8_t *buf, uint32_t n)
+{
+    uint32_t first = MIN(n, S32K358_LPUART_FIFO_CAPACITY - head);
+
+    memcpy(buf, fifo + head, first);
+    memcpy(buf + first, fifo, n - first);
+}
+
 // Update the configuration of the UART
 static void lpuart_update_parameters(S32K358LPUART *s)
 {
@@ -97,9 +140,14 @@ static void lpuart_update_parameters(S32K358LPUART *s)
     // Configure the baud rate
     // Computation at page 4618 of the reference manual: baud_rate = clock / ((OSR+1) * SBR)
     if ((s->baud & R_BAUD_SBR_MASK))
-        ssp.speed = s->pclk_frq / ((((s->baud & R_BAUD_OSR_MASK) >> R_BAUD_OSR_SHIFT) + 1) * (s->baud & R_BAUD_SBR_MASK));
+        ssp.speed = clock_get_hz(s->pclk) / ((((s->baud & R_BAUD_OSR_MASK) >> R_BAUD_OSR_SHIFT) + 1) * (s->baud & R_BAUD_SBR_MASK));
     else
-        ssp.speed = s->pclk_frq;
+        ssp.speed = clock_get_hz(s->pclk);
+
+    // Duration of a character on the line: start bit, data bits, parity bit and stop bits
+    s->char_time_ns = muldiv64(NANOSECONDS_PER_SECOND,
+                               1 + ssp.data_bits + (ssp.parity != 'N') + ssp.stop_bits,
+                               ssp.speed ? ssp.speed : 1);
 
     //  Issue a device specific ioctl to a backend.  This function is thread-safe.
     qemu_chr_fe_ioctl(&s->chr, CHR_IOCTL_SERIAL_SET_PARAMS, &ssp);
@@ -113,7 +161,8 @@ static void lpuart_update_watermark(S32K358LPUART *s)
     else
         s->stat |= R_STAT_TDRE_MASK;
 
-    if (s->rx_fifo_written > s->rx_fifo_watermark)
+    // With FIFO[RXIDEN], RDRF is also asserted when the line is idle and the FIFO is not empty
+    if (s->rx_fifo_written > s->rx_fifo_watermark || (s->rx_idle_rdrf && s->rx_fifo_written))
         s->stat |= R_STAT_RDRF_MASK;
     else
         s->stat &= ~R_STAT_RDRF_MASK;
@@ -125,12 +174,19 @@ static void lpuart_update_irq(S32K358LPUART *s)
     if (((s->ctrl & R_CTRL_TIE_MASK) && (s->stat & R_STAT_TDRE_MASK)) || // there is room in the transmit FIFO to write another transmit character to Data
         ((s->ctrl & R_CTRL_TCIE_MASK) && (s->stat & R_STAT_TC_MASK)) || // the transmitter is finished transmitting all data and is idle
         ((s->ctrl & R_CTRL_RIE_MASK) && (s->stat & R_STAT_RDRF_MASK)) || // the receive FIFO level is greater than the watermark
+        ((s->ctrl & R_CTRL_ILIE_MASK) && (s->stat & R_STAT_IDLE_MASK)) || // the receiver detected an idle line
         ((s->fifo & R_FIFO_TXOFE_MASK) && (s->fifo & R_FIFO_TXOF_MASK)) || // transmitter FIFO overflow
         ((s->fifo & R_FIFO_RXUFE_MASK) && (s->fifo & R_FIFO_RXUF_MASK))) // receiver FIFO underflow
          qemu_set_irq(s->uartint, 1);
 
     else
         qemu_set_irq(s->uartint, 0);
+
+    // DMA requests use the same flags as the interrupts
+    qemu_set_irq(s->dma_tx_req, (s->baud & R_BAUD_TDMAE_MASK) && (s->ctrl & R_CTRL_TE_MASK) &&
+                 (s->stat & R_STAT_TDRE_MASK));
+    qemu_set_irq(s->dma_rx_req, ((s->baud & R_BAUD_RDMAE_MASK) && (s->stat & R_STAT_RDRF_MASK)) ||
+                 ((s->baud & R_BAUD_RIDMAE_MASK) && (s->stat & R_STAT_IDLE_MASK)));
 }
 
 static void lpuart_reset(DeviceState *dev)
@@ -152,18 +208,104 @@ static void lpuart_reset(DeviceState *dev)
     s->stat = 0x00C00000;
     s->ctrl = 0;
     s->data = 0x00001000;
+    s->modir = 0;
+    s->tx_fifo_head = 0;
+    s->rx_fifo_head = 0;
     s->tx_fifo_written = 0;
     s->rx_fifo_written = 0;
+    s->tx_batch_len = 0;
+    s->tx_shift_busy = false;
+    s->rx_shift_busy = false;
+    timer_del(s->tx_timer);
+    timer_del(s->rx_timer);
+    timer_del(s->idle_timer);
+    s->rx_since_idle = false;
+    s->rx_idle_rdrf = false;
     s->rx_fifo_watermark = 0;
     s->tx_fifo_watermark = 0;
     // Fifo is disabled
     s->tx_fifo_size = 1;
     s->rx_fifo_size = 1;
 
+    if (s->watch_tag) {
+        g_source_remove(s->watch_tag);
+        s->watch_tag = 0;
+    }
+
     lpuart_update_parameters(s);
     lpuart_update_irq(s);
 }
 
+// Characters were received: restart the idle line detection
+static void lpuart_rx_activity(S32K358LPUART *s)
+{
+    uint32_t idle_chars = 1 << ((s->ctrl & R_CTRL_IDLECFG_MASK) >> R_CTRL_IDLECFG_SHIFT);
+    uint32_t rxiden = (s->fifo & R_FIFO_RXIDEN_MASK) >> R_FIFO_RXIDEN_SHIFT;
+
+    if (rxiden)
+        idle_chars = MIN(idle_chars, 1 << (rxiden - 1));
+
+    s->rx_last_ns = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    s->rx_since_idle = true;
+    s->rx_idle_rdrf = false;
+    timer_mod(s->idle_timer, s->rx_last_ns + idle_chars * s->char_time_ns);
+}
+
+// The line has been idle for a while: set IDLE and the RXIDEN receive flag when their time has come
+static void lpuart_idle_timer_cb(void *opaque)
+{
+    S32K358LPUART *s = S32K358_LPUART(opaque);
+    uint64_t idle = (qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) - s->rx_last_ns) / MAX(s->char_time_ns, 1);
+    uint32_t idle_chars = 1 << ((s->ctrl & R_CTRL_IDLECFG_MASK) >> R_CTRL_IDLECFG_SHIFT);
+    uint32_t rxiden = (s->fifo & R_FIFO_RXIDEN_MASK) >> R_FIFO_RXIDEN_SHIFT;
+    uint64_t next = UINT64_MAX;
+
+    if (s->rx_since_idle) {
+        if (idle >= idle_chars) {
+            s->stat |= R_STAT_IDLE_MASK;
+            s->rx_since_idle = false;
+        } else {
+            next = idle_chars;
+        }
+    }
+
+    if (rxiden && !s->rx_idle_rdrf && s->rx_fifo_written) {
+        if (idle >= (1 << (rxiden - 1)))
+            s->rx_idle_rdrf = true;
+        else
+            next = MIN(next, 1 << (rxiden - 1));
+    }
+
+    // The configuration changed in the meantime: wait for the remaining condition
+    if (next != UINT64_MAX)
+        timer_mod(s->idle_timer, s->rx_last_ns + next * s->char_time_ns);
+
+    lpuart_update_watermark(s);
+    lpuart_update_irq(s);
+}
+
+/* Number of characters that can be received before the FIFO is full or,
+ * with MODIR[RXRTSE], before the FIFO level reaches MODIR[RTSWATER] and RTS is negated
+ */
+static int lpuart_rx_space(S32K358LPUART *s)
+{
+    int limit = s->rx_fifo_size;
+    int rtswater = (s->modir & R_MODIR_RTSWATER_MASK) >> R_MODIR_RTSWATER_SHIFT;
+
+    if ((s->modir & R_MODIR_RXRTSE_MASK) && rtswater && rtswater < limit)
+        limit = rtswater;
+
+    return MAX(limit - s->rx_fifo_written, 0);
+}
+
+/* With MODIR[TXCTSE], CTS is negated while the backend cannot accept data:
+ * the transmitter then holds the characters in the FIFO
+ */
+static bool lpuart_cts_negated(S32K358LPUART *s)
+{
+    return (s->modir & R_MODIR_TXCTSE_MASK) && s->watch_tag;
+}
+
 static int lpuart_can_receive(void *opaque)
 {
     S32K358LPUART *s = S32K358_LPUART(opaque);
@@ -172,35 +314,82 @@ static int lpuart_can_receive(void *opaque)
     if (!(s->ctrl & R_CTRL_RE_MASK))
         return 0;
 
+    // In timing mode the characters go one at a time through the receive shift register
+    if (s->timing)
+        return !s->rx_shift_busy && lpuart_rx_space(s) > 0;
+
     // Returns the amount of data that the frontend can receive
-    return s->rx_fifo_size - s->rx_fifo_written;
+    return lpuart_rx_space(s);
 }
 
 static void lpuart_receive(void *opaque, const uint8_t *buf, int size)
 {
     S32K358LPUART *s = S32K358_LPUART(opaque);
+    int n;
 
     /* In fact lpuart_can_receive() ensures that we can't be
-      * called unless RX is enabled and the buffer is empty,
+      * called unless RX is enabled and there is enough room in the FIFO,
       * but we include this logic as documentation of what the
       * hardware does if a character arrives in these circumstances.
       */
     if (!(s->ctrl & R_CTRL_RE_MASK)) {
-        // Just drop the character on the floor
+        // Just drop the characters on the floor
         return;
     }
 
-    // Copy the buffer into the receive fifo
-    memcpy(s->rx_fifo + s->rx_fifo_written, buf, 1);
-    s->rx_fifo_written++;
+    // In timing mode the character reaches the fifo after a character time
+    if (s->timing) {
+        s->rx_shift = buf[0];
+        s->rx_shift_busy = true;
+        timer_mod(s->rx_timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + s->char_time_ns);
+        return;
+    }
+
+    n = MIN(size, s->rx_fifo_size - s->rx_fifo_written);
+    if (n < size) {
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "S32K358 LPUART: RxFIFO full, %d bytes dropped\n", size - n);
+    }
+    if (n <= 0) {
+        return;
+    }
+
+    // Copy the whole chunk into the receive fifo
+    lpuart_fifo_push(s->rx_fifo, s->rx_fifo_head, s->rx_fifo_written, buf, n);
+    s->rx_fifo_written += n;
     // the receive fifo is no more empty
     s->fifo &= ~R_FIFO_RXEMPT_MASK;
+    lpuart_rx_activity(s);
 
+    // Flags and IRQ are recomputed once per chunk
     lpuart_update_watermark(s);
     lpuart_update_irq(s);
 }
 
+// Timing mode: the receive shift register has received a whole character
+static void lpuart_rx_timer_cb(void *opaque)
+{
+    S32K358LPUART *s = S32K358_LPUART(opaque);
+
+    s->rx_shift_busy = false;
+
+    if ((s->ctrl & R_CTRL_RE_MASK) && s->rx_fifo_written < s->rx_fifo_size) {
+        lpuart_fifo_push(s->rx_fifo, s->rx_fifo_head, s->rx_fifo_written, &s->rx_shift, 1);
+        s->rx_fifo_written++;
+        s->fifo &= ~R_FIFO_RXEMPT_MASK;
+        lpuart_rx_activity(s);
+
+        lpuart_update_watermark(s);
+        lpuart_update_irq(s);
+    }
+
+    // The shift register is free again
+    qemu_chr_fe_accept_input(&s->chr);
+}
+
 static void lpuart_read_rx_fifo(S32K358LPUART *s) {
+    bool was_throttled = lpuart_rx_space(s) == 0;
+
     /* We tried to read from an empty receive FIFO:
      * set the underflow flag and return
      */
@@ -213,15 +402,23 @@ static void lpuart_read_rx_fifo(S32K358LPUART *s) {
 
     // Copy the first byte from the receive FIFO to the data register (to be read by the user application)
     s->data &= ~R_DATA_R07T07_MASK;
-    s->data |= s->rx_fifo[0];
+    s->data |= s->rx_fifo[s->rx_fifo_head];
+    s->rx_fifo_head = LPUART_FIFO_IDX(s->rx_fifo_head + 1);
     s->rx_fifo_written--;
-    if (s->rx_fifo_written == 0)
+    if (s->rx_fifo_written == 0) {
         s->fifo |= R_FIFO_RXEMPT_MASK;
-    else // Update the fifo
-        memmove(s->rx_fifo, s->rx_fifo + 1, s->rx_fifo_written);
+        s->rx_idle_rdrf = false;
+    }
 
-    lpuart_update_watermark(s);
-    lpuart_update_irq(s);
+    // RDRF can only change when the FIFO level drops to the watermark or the FIFO gets empty
+    if (s->rx_fifo_written == s->rx_fifo_watermark || s->rx_fifo_written == 0) {
+        lpuart_update_watermark(s);
+        lpuart_update_irq(s);
+    }
+
+    // Room was made in a full FIFO or RTS is asserted again: let the chardev deliver the next chunk
+    if (was_throttled)
+        qemu_chr_fe_accept_input(&s->chr);
 }
 
 // Return the value of the requested register
@@ -241,6 +438,9 @@ static uint64_t lpuart_read(void *opaque, hwaddr offset, unsigned size)
         lpuart_read_rx_fifo(s);
         r = s->data;
         break;
+    case A_MODIR:
+        r = s->modir;
+        break;
     case A_FIFO:
         r = s->fifo;
         break;
@@ -270,7 +470,50 @@ static uint64_t lpuart_read(void *opaque, hwaddr offset, unsigned size)
     return r;
 }
 
-/* Try to send tx data, and arrange to be called back later if
+// Move as many bytes as possible from the transmit FIFO into the batch buffer
+static void lpuart_drain_tx_fifo(S32K358LPUART *s)
+{
+    uint32_t n = MIN(s->tx_fifo_written, S32K358_LPUART_TX_BATCH_SIZE - s->tx_batch_len);
+
+    // In timing mode the fifo is emptied by the shift register at the baud rate
+    if (s->timing || !n || lpuart_cts_negated(s)) {
+        return;
+    }
+
+    lpuart_fifo_peek(s->tx_fifo, s->tx_fifo_head, s->tx_batch + s->tx_batch_len, n);
+    s->tx_batch_len += n;
+    s->tx_fifo_head = LPUART_FIFO_IDX(s->tx_fifo_head + n);
+    s->tx_fifo_written -= n;
+
+    if (s->tx_fifo_written == 0)
+        s->fifo |= R_FIFO_TXEMPT_MASK;
+}
+
+// Timing mode: move the next character of the fifo into the transmit shift register
+static void lpuart_tx_shift_load(S32K358LPUART *s)
+{
+    if (s->tx_shift_busy || !s->tx_fifo_written || !(s->ctrl & R_CTRL_TE_MASK) ||
+        lpuart_cts_negated(s)) {
+        return;
+    }
+
+    s->tx_shift = s->tx_fifo[s->tx_fifo_head];
+    s->tx_fifo_head = LPUART_FIFO_IDX(s->tx_fifo_head + 1);
+    s->tx_fifo_written--;
+    if (s->tx_fifo_written == 0)
+        s->fifo |= R_FIFO_TXEMPT_MASK;
+
+    s->tx_shift_busy = true;
+    timer_mod(s->tx_timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + s->char_time_ns);
+}
+
+// The transmitter is idle once nothing is left to send
+static bool lpuart_tx_idle(S32K358LPUART *s)
+{
+    return !s->tx_fifo_written && !s->tx_shift_busy && !s->tx_batch_len;
+}
+
+/* Try to send the batched tx data, and arrange to be called back later if
  * we can't (i.e., the char backend is busy/blocking).
  */
 static gboolean lpuart_transmit(void *do_not_use, GIOCondition cond, void *opaque)
@@ -278,9 +521,19 @@ static gboolean lpuart_transmit(void *do_not_use, GIOCondition cond, void *opaqu
     S32K358LPUART *s = S32K358_LPUART(opaque);
     int ret;
 
+    s->watch_tag = 0;
+
     // instant drain the FIFO when there's no back-end
     if (!qemu_chr_fe_backend_connected(&s->chr)) {
-        s->tx_fifo_written = 0;
+        s->tx_batch_len = 0;
+        if (!s->timing) {
+            s->tx_fifo_written = 0;
+            s->fifo |= R_FIFO_TXEMPT_MASK;
+        }
+        if (lpuart_tx_idle(s))
+            s->stat |= R_STAT_TC_MASK;
+        lpuart_update_watermark(s);
+        lpuart_update_irq(s);
         return G_SOURCE_REMOVE;
     }
 
@@ -289,42 +542,79 @@ static gboolean lpuart_transmit(void *do_not_use, GIOCondition cond, void *opaqu
         return G_SOURCE_REMOVE;
     }
 
-    // Verify that there is something to transmit
-    if (s->fifo & R_FIFO_TXEMPT_MASK) {
-        return G_SOURCE_REMOVE;
-    }
-
-    // Transmission from front-end to back-end
-    ret = qemu_chr_fe_write(&s->chr, s->tx_fifo, s->tx_fifo_written);
+    lpuart_drain_tx_fifo(s);
 
-    // Update the number of elements in the fifo and shift the fifo
-    if (ret >= 0) {
-        s->tx_fifo_written -= ret;
-        memmove(s->tx_fifo, s->tx_fifo + ret, s->tx_fifo_written);
+    // Transmission from front-end to back-end, refilling the batch from the fifo as it empties
+    while (s->tx_batch_len) {
+        ret = qemu_chr_fe_write(&s->chr, s->tx_batch, s->tx_batch_len);
+        if (ret <= 0) {
+            break;
+        }
+        s->tx_batch_len -= ret;
+        memmove(s->tx_batch, s->tx_batch + ret, s->tx_batch_len);
+        lpuart_drain_tx_fifo(s);
     }
 
-    // If there are still elements in the fifo, try to retransmit
-    if (s->tx_fifo_written) {
-        guint r = qemu_chr_fe_add_watch(&s->chr, G_IO_OUT | G_IO_HUP,
-                                        lpuart_transmit, s);
-        if (!r) {
-            s->tx_fifo_written = 0;
-            return G_SOURCE_REMOVE;
+    // If there are still elements to send, try to retransmit
+    if (s->tx_batch_len) {
+        s->watch_tag = qemu_chr_fe_add_watch(&s->chr, G_IO_OUT | G_IO_HUP,
+                                             lpuart_transmit, s);
+        if (!s->watch_tag) {
+            s->tx_batch_len = 0;
+            if (!s->timing) {
+                s->tx_fifo_written = 0;
+                s->fifo |= R_FIFO_TXEMPT_MASK;
+            }
         }
-    } else {
-        // There are no more elements in the fifo
-        // Transmission ended
-        s->stat |= R_STAT_TC_MASK;
-        // Fifo empty
-        s->fifo |= R_FIFO_TXEMPT_MASK;
     }
 
+    // CTS may be asserted again: restart the shift register
+    if (s->timing)
+        lpuart_tx_shift_load(s);
+
+    // There are no more elements to send: transmission ended
+    if (lpuart_tx_idle(s))
+        s->stat |= R_STAT_TC_MASK;
+
     lpuart_update_watermark(s);
     lpuart_update_irq(s);
 
     return G_SOURCE_REMOVE;
 }
 
+// Bottom half flushing the bytes batched by lpuart_write_tx_fifo()
+static void lpuart_tx_bh(void *opaque)
+{
+    S32K358LPUART *s = S32K358_LPUART(opaque);
+
+    // A pending watch will flush the batch once the backend is writable again
+    if (s->watch_tag) {
+        return;
+    }
+
+    lpuart_transmit(NULL, G_IO_OUT, s);
+}
+
+// Timing mode: the transmit shift register has sent a whole character
+static void lpuart_tx_timer_cb(void *opaque)
+{
+    S32K358LPUART *s = S32K358_LPUART(opaque);
+
+    // The backend is stalled and the batch is full: hold the line for another character time
+    if (s->tx_batch_len == S32K358_LPUART_TX_BATCH_SIZE) {
+        timer_mod(s->tx_timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + s->char_time_ns);
+        return;
+    }
+
+    s->tx_batch[s->tx_batch_len++] = s->tx_shift;
+    s->tx_shift_busy = false;
+    lpuart_tx_shift_load(s);
+
+    lpuart_update_watermark(s);
+    lpuart_update_irq(s);
+    qemu_bh_schedule(s->tx_bh);
+}
+
 static void lpuart_write_tx_fifo(S32K358LPUART *s) {
     // if the transmitter is not enabled, return
     if (!(s->ctrl & R_CTRL_TE_MASK)) {
@@ -344,16 +634,30 @@ static void lpuart_write_tx_fifo(S32K358LPUART *s) {
     // The fifo is no more empty
     s->fifo &= ~R_FIFO_TXEMPT_MASK;
 
-    uint8_t msg = s->data & R_DATA_R07T07_MASK;
-
     // Write the data into the fifo
-    memcpy(s->tx_fifo + s->tx_fifo_written, &msg, 1);
+    s->tx_fifo[LPUART_FIFO_IDX(s->tx_fifo_head + s->tx_fifo_written)] = s->data & R_DATA_R07T07_MASK;
     s->tx_fifo_written += 1;
 
+    if (s->timing) {
+        lpuart_tx_shift_load(s);
+        lpuart_update_watermark(s);
+        lpuart_update_irq(s);
+        return;
+    }
+
+    /* The byte is moved to the batch buffer right away, so TDRE and TXCOUNT
+     * behave as if it had been transmitted. The chardev write is deferred to
+     * the bottom half, unless the batch is full and must be flushed now.
+     */
+    lpuart_drain_tx_fifo(s);
+    if (s->tx_batch_len == S32K358_LPUART_TX_BATCH_SIZE && !s->watch_tag) {
+        lpuart_transmit(NULL, G_IO_OUT, s);
+        return;
+    }
+
     lpuart_update_watermark(s);
     lpuart_update_irq(s);
-    // Transmit the data contained in the transmit FIFO
-    lpuart_transmit(NULL, G_IO_OUT, s);
+    qemu_bh_schedule(s->tx_bh);
 }
 
 // Write to the UART registers
@@ -397,6 +701,12 @@ static void lpuart_write(void *opaque, hwaddr offset, uint64_t value,
         break;
 
     case A_BAUD:
+        // The DMA enables can be changed at any time
+        if (((s->baud ^ value) & ~(R_BAUD_TDMAE_MASK | R_BAUD_RDMAE_MASK | R_BAUD_RIDMAE_MASK)) == 0) {
+            s->baud = value;
+            lpuart_update_irq(s);
+            break;
+        }
         // Check if receiver and transmitter are disabled
         if ((s->ctrl & R_CTRL_RE_MASK) || (s->ctrl & R_CTRL_TE_MASK)) {
             qemu_log_mask(LOG_GUEST_ERROR,
@@ -405,7 +715,8 @@ static void lpuart_write(void *opaque, hwaddr offset, uint64_t value,
         }
 
         if (value & ~(R_BAUD_BOTHEDGE_MASK | R_BAUD_OSR_MASK |
-            R_BAUD_SBNS_MASK | R_BAUD_SBR_MASK)) {
+            R_BAUD_SBNS_MASK | R_BAUD_SBR_MASK | R_BAUD_TDMAE_MASK |
+            R_BAUD_RDMAE_MASK | R_BAUD_RIDMAE_MASK)) {
              qemu_log_mask(LOG_GUEST_ERROR,
                           "S32K358 LPUART: BAUD unimplemented fields\n");
             break;
@@ -427,21 +738,26 @@ static void lpuart_write(void *opaque, hwaddr offset, uint64_t value,
         s->baud = value;
 
         lpuart_update_parameters(s);
+        lpuart_update_irq(s);
         break;
 
     case A_STAT:
-        if (value & (R_STAT_TC_MASK | R_STAT_TDRE_MASK | R_STAT_RDRF_MASK)) {
-            qemu_log_mask(LOG_GUEST_ERROR,
-                          "S32K358 LPUART: STAT TC, TDRE and RDRF are readonly\n");
-                break;
+        // TC, TDRE and RDRF are read-only and ignored, so a read-modify-write can clear IDLE
+        value &= ~(R_STAT_TC_MASK | R_STAT_TDRE_MASK | R_STAT_RDRF_MASK);
+        // IDLE is cleared by writing 1
+        if (value & R_STAT_IDLE_MASK) {
+            s->stat &= ~R_STAT_IDLE_MASK;
+            lpuart_update_irq(s);
         }
-        qemu_log_mask(LOG_GUEST_ERROR,
+        if (value & ~R_STAT_IDLE_MASK)
+            qemu_log_mask(LOG_GUEST_ERROR,
                           "S32K358 LPUART: STAT unimplemented fields\n");
 
         break;
     case A_CTRL:
         if (value & ~(R_CTRL_PT_MASK | R_CTRL_PE_MASK | R_CTRL_TE_MASK |
-            R_CTRL_RE_MASK | R_CTRL_TCIE_MASK | R_CTRL_TIE_MASK | R_CTRL_RIE_MASK)) {
+            R_CTRL_RE_MASK | R_CTRL_TCIE_MASK | R_CTRL_TIE_MASK | R_CTRL_RIE_MASK |
+            R_CTRL_ILT_MASK | R_CTRL_IDLECFG_MASK | R_CTRL_ILIE_MASK)) {
                 qemu_log_mask(LOG_GUEST_ERROR,
                           "S32K358 LPUART: CTRL unimplemented fields\n");
                 break;
@@ -450,6 +766,15 @@ static void lpuart_write(void *opaque, hwaddr offset, uint64_t value,
         s->ctrl = value;
         lpuart_update_parameters(s);
         lpuart_update_irq(s);
+        // The receiver may have been enabled: ask the chardev for data
+        if (s->ctrl & R_CTRL_RE_MASK)
+            qemu_chr_fe_accept_input(&s->chr);
+        // Resume a transmission that was stopped by disabling the transmitter
+        if ((s->ctrl & R_CTRL_TE_MASK) && (s->tx_batch_len || s->tx_fifo_written)) {
+            if (s->timing)
+                lpuart_tx_shift_load(s);
+            qemu_bh_schedule(s->tx_bh);
+        }
         break;
 
     case A_DATA:
@@ -463,10 +788,31 @@ static void lpuart_write(void *opaque, hwaddr offset, uint64_t value,
         lpuart_write_tx_fifo(s);
         break;
 
+    case A_MODIR:
+        if (value & ~(R_MODIR_TXCTSE_MASK | R_MODIR_RXRTSE_MASK | R_MODIR_RTSWATER_MASK)) {
+            qemu_log_mask(LOG_GUEST_ERROR,
+                          "S32K358 LPUART: MODIR unimplemented fields\n");
+                break;
+        } else if ((s->id >= 2) && (value & R_MODIR_RTSWATER_MASK & ~R_MODIR_RTSWATER_SHORT_MASK)) {
+            qemu_log_mask(LOG_GUEST_ERROR,
+                          "S32K358 LPUART: RTSWATER must be smaller for lpuart2...lpuart15\n");
+                break;
+        }
+
+        // Check if receiver and transmitter are disabled
+        if ((s->ctrl & R_CTRL_RE_MASK) || (s->ctrl & R_CTRL_TE_MASK)) {
+            qemu_log_mask(LOG_GUEST_ERROR,
+                          "S32K358 LPUART: to change the modir register transmitter and receiver must be disabled.\n");
+                break;
+        }
+
+        s->modir = value;
+        break;
+
     case A_FIFO:
         if (value & ~(R_FIFO_TXFLUSH_MASK | R_FIFO_RXFLUSH_MASK | R_FIFO_TXOF_MASK |
              R_FIFO_RXUF_MASK | R_FIFO_TXFE_MASK | R_FIFO_RXFE_MASK |
-             R_FIFO_TXOFE_MASK | R_FIFO_RXUFE_MASK)) {
+             R_FIFO_TXOFE_MASK | R_FIFO_RXUFE_MASK | R_FIFO_RXIDEN_MASK)) {
                 qemu_log_mask(LOG_GUEST_ERROR,
                           "S32K358 LPUART: FIFO unimplemented or read only fields\n");
                 break;
@@ -490,7 +836,9 @@ static void lpuart_write(void *opaque, hwaddr offset, uint64_t value,
         if (value & R_FIFO_RXFLUSH_MASK) {
             s->rx_fifo_written = 0;
             s->fifo |= R_FIFO_RXEMPT_MASK;
-            s->stat &= R_STAT_RDRF_MASK;
+            s->stat &= ~R_STAT_RDRF_MASK;
+            s->rx_idle_rdrf = false;
+            qemu_chr_fe_accept_input(&s->chr);
         }
         if (value & R_FIFO_TXFLUSH_MASK) {
             s->tx_fifo_written = 0;
@@ -498,8 +846,8 @@ static void lpuart_write(void *opaque, hwaddr offset, uint64_t value,
             s->stat |= R_STAT_TDRE_MASK;
         }
 
-        s->fifo &= ~(R_FIFO_TXOFE_MASK | R_FIFO_RXUFE_MASK | R_FIFO_TXFE_MASK | R_FIFO_RXFE_MASK);
-        s->fifo |= value & (R_FIFO_TXOFE_MASK | R_FIFO_RXUFE_MASK | R_FIFO_TXFE_MASK | R_FIFO_RXFE_MASK);
+        s->fifo &= ~(R_FIFO_TXOFE_MASK | R_FIFO_RXUFE_MASK | R_FIFO_TXFE_MASK | R_FIFO_RXFE_MASK | R_FIFO_RXIDEN_MASK);
+        s->fifo |= value & (R_FIFO_TXOFE_MASK | R_FIFO_RXUFE_MASK | R_FIFO_TXFE_MASK | R_FIFO_RXFE_MASK | R_FIFO_RXIDEN_MASK);
 
         // Change the rx fifo dimension
         if (value & R_FIFO_RXFE_MASK) {
@@ -511,7 +859,7 @@ static void lpuart_write(void *opaque, hwaddr offset, uint64_t value,
             s->rx_fifo_size = 1;
 
         // Change the tx fifo dimension
-        if (value & R_FIFO_RXFE_MASK) {
+        if (value & R_FIFO_TXFE_MASK) {
             if (s->id < 2)
                 s->tx_fifo_size = S32K358_LPUART_0_1_TX_FIFO_SIZE;
             else
@@ -540,8 +888,8 @@ static void lpuart_write(void *opaque, hwaddr offset, uint64_t value,
             s->rx_fifo_watermark = (value & R_WATER_RXWATER_SHORT_MASK) >> R_WATER_RXWATER_SHORT_SHIFT;
         }
 
-
         lpuart_update_watermark(s);
+        lpuart_update_irq(s);
         break;
 
     default:
@@ -557,6 +905,12 @@ static const MemoryRegionOps lpuart_ops = {
     .endianness = DEVICE_NATIVE_ENDIAN,
 };
 
+// The baud rate follows the frequency of the functional clock
+static void lpuart_clk_update(void *opaque, ClockEvent event)
+{
+    lpuart_update_parameters(S32K358_LPUART(opaque));
+}
+
 static void lpuart_init(Object *obj)
 {
     SysBusDevice *sbd = SYS_BUS_DEVICE(obj);
@@ -565,18 +919,27 @@ static void lpuart_init(Object *obj)
     memory_region_init_io(&s->iomem, obj, &lpuart_ops, s, "uart", 0x0800);
     sysbus_init_mmio(sbd, &s->iomem);
     sysbus_init_irq(sbd, &s->uartint);
+    // Hardware requests towards the DMAMUX
+    qdev_init_gpio_out_named(DEVICE(obj), &s->dma_tx_req, "dma-tx-req", 1);
+    qdev_init_gpio_out_named(DEVICE(obj), &s->dma_rx_req, "dma-rx-req", 1);
+    s->pclk = qdev_init_clock_in(DEVICE(obj), "pclk", lpuart_clk_update, s, ClockUpdate);
 }
 
 static void lpuart_realize(DeviceState *dev, Error **errp)
 {
     S32K358LPUART *s = S32K358_LPUART(dev);
 
-    if (s->pclk_frq == 0) {
-        error_setg(errp, "S32K358 LPUART: pclk-frq property must be set");
+    if (!clock_has_source(s->pclk)) {
+        error_setg(errp, "S32K358 LPUART: pclk clock must be connected");
         return;
     }
 
-    // Flow control not implemented
+    s->tx_bh = qemu_bh_new_guarded(lpuart_tx_bh, s, &dev->mem_reentrancy_guard);
+    s->tx_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, lpuart_tx_timer_cb, s);
+    s->rx_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, lpuart_rx_timer_cb, s);
+    s->idle_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, lpuart_idle_timer_cb, s);
+
+    // Hardware flow control (MODIR) is mapped on the chardev backpressure
     // Handlers to allow the UART work in the receive direction
     qemu_chr_fe_set_handlers(&s->chr, lpuart_can_receive, lpuart_receive,
                              NULL, NULL, s, NULL, true);
@@ -587,16 +950,128 @@ static int lpuart_post_load(void *opaque, int version_id)
 {
     S32K358LPUART *s = S32K358_LPUART(opaque);
 
+    // Version 2 has no FIFO sizes: rebuild them from the FIFO register
+    if (version_id < 3) {
+        if (s->fifo & R_FIFO_RXFE_MASK)
+            s->rx_fifo_size = s->id < 2 ? S32K358_LPUART_0_1_RX_FIFO_SIZE
+                                        : S32K358_LPUART_2_15_RX_FIFO_SIZE;
+        else
+            s->rx_fifo_size = 1;
+        if (s->fifo & R_FIFO_TXFE_MASK)
+            s->tx_fifo_size = s->id < 2 ? S32K358_LPUART_0_1_TX_FIFO_SIZE
+                                        : S32K358_LPUART_2_15_TX_FIFO_SIZE;
+        else
+            s->tx_fifo_size = 1;
+    }
+    // The FIFOs are indexed with these values, so a corrupted stream must not get through
+    if (s->rx_fifo_size > S32K358_LPUART_FIFO_CAPACITY ||
+        s->tx_fifo_size > S32K358_LPUART_FIFO_CAPACITY ||
+        s->rx_fifo_head >= S32K358_LPUART_FIFO_CAPACITY ||
+        s->tx_fifo_head >= S32K358_LPUART_FIFO_CAPACITY ||
+        s->rx_fifo_written > s->rx_fifo_size ||
+        s->tx_fifo_written > s->tx_fifo_size)
+        return -EINVAL;
+    if (s->tx_batch_len > S32K358_LPUART_TX_BATCH_SIZE)
+        return -EINVAL;
+
     lpuart_update_parameters(s);
     lpuart_update_irq(s);
+    // The chardev watch is not migrated: restart the pending transmission
+    if (s->tx_batch_len || s->tx_fifo_written)
+        qemu_bh_schedule(s->tx_bh);
     return 0;
 }
 
-// To make the device snapshoptable: it is not fully implemented
-static const VMStateDescription lpuart_vmstate = {
-    .name = "s32k358-lpuart",
+static bool lpuart_modem_needed(void *opaque)
+{
+    S32K358LPUART *s = S32K358_LPUART(opaque);
+
+    return s->modir != 0;
+}
+
+// Hardware flow control
+static const VMStateDescription lpuart_modem_vmstate = {
+    .name = "s32k358-lpuart/modem",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .needed = lpuart_modem_needed,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT32(modir, S32K358LPUART),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static bool lpuart_tx_batch_needed(void *opaque)
+{
+    S32K358LPUART *s = S32K358_LPUART(opaque);
+
+    return s->tx_batch_len != 0;
+}
+
+// Characters already shifted out of the FIFO but not yet accepted by the chardev
+static const VMStateDescription lpuart_tx_batch_vmstate = {
+    .name = "s32k358-lpuart/tx-batch",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .needed = lpuart_tx_batch_needed,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT32(tx_batch_len, S32K358LPUART),
+        VMSTATE_UINT8_ARRAY(tx_batch, S32K358LPUART, S32K358_LPUART_TX_BATCH_SIZE),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static bool lpuart_timing_needed(void *opaque)
+{
+    S32K358LPUART *s = S32K358_LPUART(opaque);
+
+    return s->timing;
+}
+
+// Shift registers of the timing-accurate mode
+static const VMStateDescription lpuart_timing_vmstate = {
+    .name = "s32k358-lpuart/timing",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .needed = lpuart_timing_needed,
+    .fields = (const VMStateField[]) {
+        VMSTATE_BOOL(tx_shift_busy, S32K358LPUART),
+        VMSTATE_BOOL(rx_shift_busy, S32K358LPUART),
+        VMSTATE_UINT8(tx_shift, S32K358LPUART),
+        VMSTATE_UINT8(rx_shift, S32K358LPUART),
+        VMSTATE_TIMER_PTR(tx_timer, S32K358LPUART),
+        VMSTATE_TIMER_PTR(rx_timer, S32K358LPUART),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static bool lpuart_idle_needed(void *opaque)
+{
+    S32K358LPUART *s = S32K358_LPUART(opaque);
+
+    return s->rx_since_idle || s->rx_idle_rdrf || timer_pending(s->idle_timer);
+}
+
+// Idle line detection
+static const VMStateDescription lpuart_idle_vmstate = {
+    .name = "s32k358-lpuart/idle",
     .version_id = 1,
     .minimum_version_id = 1,
+    .needed = lpuart_idle_needed,
+    .fields = (const VMStateField[]) {
+        VMSTATE_INT64(rx_last_ns, S32K358LPUART),
+        VMSTATE_BOOL(rx_since_idle, S32K358LPUART),
+        VMSTATE_BOOL(rx_idle_rdrf, S32K358LPUART),
+        VMSTATE_TIMER_PTR(idle_timer, S32K358LPUART),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+// To make the device snapshoptable
+static const VMStateDescription lpuart_vmstate = {
+    .name = "s32k358-lpuart",
+    .version_id = 4,
+    .minimum_version_id = 2,
     .post_load = lpuart_post_load,
     .fields = (const VMStateField[]) {
         VMSTATE_UINT32(id, S32K358LPUART),
@@ -608,16 +1083,33 @@ static const VMStateDescription lpuart_vmstate = {
         VMSTATE_UINT32(ctrl, S32K358LPUART),
         VMSTATE_UINT32(data, S32K358LPUART),
         VMSTATE_UINT32(fifo, S32K358LPUART),
-        VMSTATE_UINT8_ARRAY(rx_fifo, S32K358LPUART, S32K358_LPUART_0_1_RX_FIFO_SIZE),
-        VMSTATE_UINT8_ARRAY(tx_fifo, S32K358LPUART, S32K358_LPUART_0_1_TX_FIFO_SIZE),
+        VMSTATE_UINT8_ARRAY(rx_fifo, S32K358LPUART, S32K358_LPUART_FIFO_CAPACITY),
+        VMSTATE_UINT8_ARRAY(tx_fifo, S32K358LPUART, S32K358_LPUART_FIFO_CAPACITY),
+        VMSTATE_UINT8(rx_fifo_head, S32K358LPUART),
+        VMSTATE_UINT8(tx_fifo_head, S32K358LPUART),
+        VMSTATE_UINT8(rx_fifo_written, S32K358LPUART),
+        VMSTATE_UINT8(tx_fifo_written, S32K358LPUART),
+        VMSTATE_UINT8_V(rx_fifo_size, S32K358LPUART, 3),
+        VMSTATE_UINT8_V(tx_fifo_size, S32K358LPUART, 3),
+        VMSTATE_UINT8_V(rx_fifo_watermark, S32K358LPUART, 3),
+        VMSTATE_UINT8_V(tx_fifo_watermark, S32K358LPUART, 3),
+        VMSTATE_CLOCK_V(pclk, S32K358LPUART, 4),
         VMSTATE_END_OF_LIST()
+    },
+    .subsections = (const VMStateDescription * const []) {
+        &lpuart_modem_vmstate,
+        &lpuart_tx_batch_vmstate,
+        &lpuart_timing_vmstate,
+        &lpuart_idle_vmstate,
+        NULL
     }
 };
 
 static Property lpuart_properties[] = {
     DEFINE_PROP_CHR("chardev", S32K358LPUART, chr),
-    DEFINE_PROP_UINT32("pclk-frq", S32K358LPUART, pclk_frq, 0),
     DEFINE_PROP_UINT32("id", S32K358LPUART, id, 0),
+    // Transmit and receive at the programmed baud rate instead of instantly
+    DEFINE_PROP_BOOL("timing", S32K358LPUART, timing, false),
     DEFINE_PROP_END_OF_LIST(),
 };
 
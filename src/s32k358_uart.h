@@ -11,6 +11,8 @@
 
 #include "hw/sysbus.h"
 #include "chardev/char-fe.h"
+#include "hw/clock.h"
+#include "qemu/timer.h"
 #include "qom/object.h"
 
 #define TYPE_S32K358_LPUART "s32k358_lpuart"
@@ -21,6 +23,10 @@ OBJECT_DECLARE_SIMPLE_TYPE(S32K358LPUART, S32K358_LPUART)
 #define S32K358_LPUART_0_1_TX_FIFO_SIZE           16
 #define S32K358_LPUART_2_15_RX_FIFO_SIZE           4
 #define S32K358_LPUART_2_15_TX_FIFO_SIZE           4
+// Size of the ring buffers backing the FIFOs (must be a power of two)
+#define S32K358_LPUART_FIFO_CAPACITY              16
+// Bytes shifted out of the transmit FIFO are collected here before being written to the chardev
+#define S32K358_LPUART_TX_BATCH_SIZE             256
 
 struct S32K358LPUART {
     /*< private >*/
@@ -30,30 +36,65 @@ struct S32K358LPUART {
     MemoryRegion iomem; // memory region for the memory mapping
     CharBackend chr;
     qemu_irq uartint; // IRQ number
+    qemu_irq dma_tx_req; // transmit DMA request (BAUD[TDMAE])
+    qemu_irq dma_rx_req; // receive DMA request (BAUD[RDMAE], BAUD[RIDMAE])
+    Clock *pclk; // functional clock, it determines the baud rate
     guint watch_tag;
 
     uint32_t id;
     uint32_t verid;
     uint32_t param;
-    uint32_t pclk_frq;
     uint32_t baud;
     uint32_t global;
     uint32_t stat;
     uint32_t ctrl;
     uint32_t data;
+    uint32_t modir;
     uint32_t fifo;
     uint32_t txcnt;
     uint32_t rxcnt;
 
-    /* This UART has a FIFO */
-    uint8_t rx_fifo[S32K358_LPUART_0_1_RX_FIFO_SIZE];
-    uint8_t tx_fifo[S32K358_LPUART_0_1_TX_FIFO_SIZE];
+    /* This UART has a FIFO, implemented as a ring buffer:
+     * *_fifo_head is the index of the oldest byte and
+     * *_fifo_written the number of bytes stored
+     */
+    uint8_t rx_fifo[S32K358_LPUART_FIFO_CAPACITY];
+    uint8_t tx_fifo[S32K358_LPUART_FIFO_CAPACITY];
     uint8_t tx_fifo_size;
     uint8_t rx_fifo_size;
+    uint8_t tx_fifo_head;
+    uint8_t rx_fifo_head;
     uint8_t tx_fifo_written;
     uint8_t rx_fifo_written;
     uint8_t tx_fifo_watermark;
     uint8_t rx_fifo_watermark;
+
+    /* Transmit batching: the FIFO is drained into tx_batch and tx_bh
+     * writes the whole batch to the chardev at once
+     */
+    QEMUBH *tx_bh;
+    uint8_t tx_batch[S32K358_LPUART_TX_BATCH_SIZE];
+    uint32_t tx_batch_len;
+
+    /* Timing-accurate mode ("timing" property): the shift registers
+     * move one character every char_time_ns of virtual time
+     */
+    bool timing;
+    uint64_t char_time_ns;
+    QEMUTimer *tx_timer;
+    QEMUTimer *rx_timer;
+    bool tx_shift_busy;
+    bool rx_shift_busy;
+    uint8_t tx_shift;
+    uint8_t rx_shift;
+
+    /* Idle line detection: idle_timer expires once the line has been idle
+     * for the number of characters programmed in CTRL[IDLECFG] or FIFO[RXIDEN]
+     */
+    QEMUTimer *idle_timer;
+    int64_t rx_last_ns; // end of the last received character
+    bool rx_since_idle; // a character was received since IDLE was last set
+    bool rx_idle_rdrf; // RDRF asserted by FIFO[RXIDEN]
 };
 
 #endif
\ No newline at end of file